@@ -0,0 +1,13 @@
+TEMPLATE = app
+TARGET = photosphere-batch
+
+QT += qml quick
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+include($$PWD/../qmlpanorama.pri)
+SOURCES += main.cpp
+
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
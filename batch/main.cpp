@@ -0,0 +1,93 @@
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QUrl>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QDebug>
+#include "photospherebatch.h"
+
+// Renders the views listed in a JSON file, e.g.
+// [ { "source": "pano.jpg", "azimuth": 90, "elevation": 10, "fieldOfView": 75,
+//     "width": 320, "height": 240, "output": "thumbs/pano_90.jpg" } ]
+// Sources are urls, or the maps accepted by PhotoSphere::source. Relative paths
+// are resolved against the directory of the JSON file.
+// Use -platform offscreen, or eglfs, on machines without a display.
+
+namespace {
+QString resolve(const QDir &dir, const QString &path)
+{
+    const QUrl url(path);
+    if (!url.isRelative() || QFileInfo(path).isAbsolute())
+        return path;
+    return QUrl::fromLocalFile(dir.absoluteFilePath(path)).toString();
+}
+}
+
+int main(int argc, char *argv[])
+{
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Renders views of panoramas to image files."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("jobs"), QStringLiteral("The JSON file listing the views to render."));
+    QCommandLineOption qualityOption(QStringLiteral("quality"),
+                                     QStringLiteral("The quality of the written images, 0 to 100."),
+                                     QStringLiteral("quality"), QStringLiteral("-1"));
+    parser.addOption(qualityOption);
+    parser.process(app);
+
+    if (parser.positionalArguments().size() != 1)
+        parser.showHelp(1);
+
+    QFile file(parser.positionalArguments().first());
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Failed opening "<< file.fileName();
+        return 1;
+    }
+    QJsonParseError error;
+    const QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &error);
+    if (!document.isArray()) {
+        qWarning() << "Invalid jobs file "<< file.fileName() << ": "<< error.errorString();
+        return 1;
+    }
+
+    const QDir dir = QFileInfo(file).absoluteDir();
+    QVector<PhotoSphereBatchRenderer::Job> jobs;
+    for (const QJsonValue &value : document.array()) {
+        const QJsonObject object = value.toObject();
+        PhotoSphereBatchRenderer::Job job;
+        if (object.value(QStringLiteral("source")).isObject()) {
+            QVariantMap source = object.value(QStringLiteral("source")).toObject().toVariantMap();
+            for (auto it = source.begin(); it != source.end(); ++it) {
+                if (it.value().type() == QVariant::String)
+                    it.value() = resolve(dir, it.value().toString());
+            }
+            job.source = source;
+        } else {
+            job.source = resolve(dir, object.value(QStringLiteral("source")).toString());
+        }
+        job.azimuth = object.value(QStringLiteral("azimuth")).toDouble(job.azimuth);
+        job.elevation = object.value(QStringLiteral("elevation")).toDouble(job.elevation);
+        job.fieldOfView = object.value(QStringLiteral("fieldOfView")).toDouble(job.fieldOfView);
+        job.size = QSize(object.value(QStringLiteral("width")).toInt(job.size.width()),
+                         object.value(QStringLiteral("height")).toInt(job.size.height()));
+        job.fileName = dir.absoluteFilePath(object.value(QStringLiteral("output")).toString());
+        if (object.value(QStringLiteral("output")).toString().isEmpty()) {
+            qWarning() << "Skipping job without output: "<< object;
+            continue;
+        }
+        jobs.append(job);
+    }
+
+    PhotoSphereBatchRenderer renderer;
+    renderer.setQuality(parser.value(qualityOption).toInt());
+    const int failed = renderer.render(jobs);
+    if (failed)
+        qWarning() << failed << " of "<< jobs.size() << " views failed";
+    return failed ? 1 : 0;
+}
@@ -1,9 +1,29 @@
 HEADERS += $${PWD}/src/photosphere.h \
+           $${PWD}/src/photospherebatch.h \
+           $${PWD}/src/photospherecache.h \
+           $${PWD}/src/photosphereconvert.h \
+           $${PWD}/src/photospherektx.h \
+           $${PWD}/src/photosphererender_p.h \
+           $${PWD}/src/photospherestats.h \
+           $${PWD}/src/photospheretiles.h \
+           $${PWD}/src/photosphereutils_p.h \
            $${PWD}/src/qmlpanorama.h
 
-SOURCES += $${PWD}/src/photosphere.cpp
+SOURCES += $${PWD}/src/photosphere.cpp \
+           $${PWD}/src/photospherebatch.cpp \
+           $${PWD}/src/photospherecache.cpp \
+           $${PWD}/src/photosphereconvert.cpp \
+           $${PWD}/src/photospherektx.cpp \
+           $${PWD}/src/photospherestats.cpp \
+           $${PWD}/src/photospheretiles.cpp
 
 INCLUDEPATH += $${PWD}/src
 
 QT += quick
 CONFIG += c++11
+
+# For the compiler to vectorize the mapping of the cube map conversion, in photosphereconvert.cpp
+gcc {
+    QMAKE_CXXFLAGS += -fno-math-errno
+    !clang: QMAKE_CXXFLAGS += -ftree-vectorize -fvect-cost-model=dynamic -fno-trapping-math
+}
@@ -17,7 +17,13 @@
 ****************************************************************************/
 
 #include "photosphere.h"
+#include "photospherecache.h"
+#include "photospheretiles.h"
+#include "photosphereutils_p.h"
+#include "photosphererender_p.h"
 #include <QtQuick/QQuickWindow>
+#include <QtQuick/QSGRenderNode>
+#include <QtQuick/QSGRendererInterface>
 #include <QtGui/qopenglshaderprogram.h>
 #include <QtGui/qopenglcontext.h>
 #include <QtGui/qopenglfunctions.h>
@@ -25,26 +31,70 @@
 #include <QtGui/QOpenGLBuffer>
 #include <QtGui/QOpenGLVertexArrayObject>
 #include <QtGui/QOpenGLFramebufferObjectFormat>
-#include <QNetworkAccessManager>
-#include <QNetworkDiskCache>
-#include <QNetworkReply>
 #include <QScopedPointer>
 #include <QSharedPointer>
-#include <QEventLoop>
 #include <QVector3D>
+#include <QMatrix4x4>
+#include <QVector4D>
+#include <QQuaternion>
+#include <QThread>
+#include <QCoreApplication>
+#include <QElapsedTimer>
 #include <QPointer>
+#include <QSet>
+#include <QtMath>
+#include <algorithm>
 #include <array>
 #include <cmath>
+#include <functional>
+#include <memory>
+#include <numeric>
 
 namespace  {
-const QMap<QString, CubeFace> nameToCubeFace {{
-        {"PositiveZ" , CubeFace::PZ},
-        {"PositiveX" , CubeFace::PX},
-        {"PositiveY" , CubeFace::PY},
-        {"NegativeZ" , CubeFace::MZ},
-        {"NegativeY" , CubeFace::MY},
-        {"NegativeX" , CubeFace::MX}
-}};
+PhotoSphereImage::Conversion imageConversion(QmlPhotoSphere::CubeMapConversion conversion)
+{
+    switch (conversion) {
+    case QmlPhotoSphere::BilinearConversion:
+        return PhotoSphereImage::BilinearCubeMap;
+    case QmlPhotoSphere::BicubicConversion:
+        return PhotoSphereImage::BicubicCubeMap;
+    default:
+        return PhotoSphereImage::NoConversion;
+    }
+}
+
+/// The rotation of the view for azimuth and elevation, in degrees, and for the orientation of
+/// the viewer relative to them, see QmlPhotoSphere::setSensorOrientation()
+QMatrix4x4 viewMatrix(qreal azimuth, qreal elevation, const QQuaternion &orientation)
+{
+    QMatrix4x4 matAzimuth;
+    matAzimuth.rotate(azimuth, 0, 1, 0);
+
+    QMatrix4x4 matElevation;
+    matElevation.rotate(elevation, -1, 0, 0);
+
+    QMatrix4x4 matOrientation;
+    matOrientation.rotate(orientation.conjugated());
+    return matOrientation * matElevation * matAzimuth;
+}
+
+/// The half angle, in radians, of the cone containing the view frustum, and its axis, in viewDir
+qreal viewCone(const QMatrix4x4 &matView, qreal fov, qreal aspectRatio, QVector3D *viewDir)
+{
+    *viewDir = matView.inverted().mapVector(QVector3D(0, 0, -1));
+    const qreal tanV = std::tan(qDegreesToRadians(fov) * 0.5);
+    const qreal tanH = tanV * aspectRatio;
+    return std::atan(std::sqrt(tanV * tanV + tanH * tanH));
+}
+
+/// The faces of a cube map in view for matView and fov, in degrees, nearest to the
+/// center of the view first
+QVector<CubeFace> visibleFaces(const QMatrix4x4 &matView, qreal fov, qreal aspectRatio)
+{
+    QVector3D viewDir;
+    const qreal halfAngle = viewCone(matView, fov, aspectRatio, &viewDir);
+    return PhotoSphereTileLayout::visibleFaces(viewDir, halfAngle);
+}
 #if 0
 std::array<QColor, 6> faceColors {{ // for debugging purposes
         {255,0,0},
@@ -55,14 +105,20 @@ std::array<QColor, 6> faceColors {{ // for debugging purposes
         {128,128,255}
     }};
 #endif
+// t = 0 is the top row of the image. flipY is 1 for textures stored bottom row first,
+// like some compressed ones, 0 otherwise. eyeRect is the area of the image drawn, as
+// offset and size, see QmlPhotoSphere::stereoSource.
 static constexpr char vertexShaderSourceSphere[] =
 "attribute highp vec4 vCoord;\n"
 "attribute highp vec2 vTexCoord;\n"
 "uniform highp mat4 matrix;\n"
+"uniform highp float flipY;\n"
+"uniform highp vec4 eyeRect;\n"
 "varying highp vec2 texCoord;\n"
 "void main()\n"
 "{\n"
-"    texCoord = vTexCoord.xy;\n"
+"    highp float t = eyeRect.y + vTexCoord.y * eyeRect.w;\n"
+"    texCoord = vec2(eyeRect.x + vTexCoord.x * eyeRect.z, mix(t, 1.0 - t, flipY));\n"
 "    gl_Position = matrix * vCoord;\n"
 "}\n"
 "\n";
@@ -79,6 +135,48 @@ static constexpr char fragmentShaderSourceSphere[] =
 "}\n"
 "\n";
 
+// Ray casting of equirectangular images. matrix maps clip space coordinates to view directions,
+// and the image coordinates of each direction are computed per fragment, the same as on the
+// vertices of Sphere3D: s = 1 - (azimuth - pi/2) / 2pi, t = (pi/2 - elevation) / pi.
+static constexpr char vertexShaderSourceSphereRayCast[] =
+"attribute highp vec4 vCoord;\n"
+"uniform highp mat4 matrix;\n"
+"varying highp vec3 viewDir;\n"
+"void main()\n"
+"{\n"
+"    viewDir = (matrix * vec4(vCoord.xy, -1.0, 0.0)).xyz;\n"
+"    gl_Position = vec4(vCoord.xy, 0.0, 1.0);\n"
+"}\n"
+"\n";
+
+// Prefixed with HAS_DERIVATIVES where fwidth is available, to avoid sampling the coarsest
+// mip level along the seam, where s wraps around.
+static constexpr char fragmentShaderSourceSphereRayCast[] =
+"#define texture texture2D\n"
+"varying highp vec3 viewDir;\n"
+"uniform highp vec4 color;\n"
+"uniform highp float flipY;\n"
+"uniform highp vec4 eyeRect;\n"
+"uniform sampler2D samImage; \n"
+"const highp float pi = 3.14159265358979;\n"
+"void main()\n"
+"{\n"
+"    highp vec3 d = normalize(viewDir);\n"
+"    highp float s = fract(1.25 - atan(-d.z, d.x) / (2.0 * pi));\n"
+"#ifdef HAS_DERIVATIVES\n"
+"    highp float s2 = fract(s + 0.5) - 0.5;\n"
+"    if (fwidth(s2) < fwidth(s))\n"
+"        s = s2;\n"
+"#endif\n"
+"    highp float t = 0.5 - asin(clamp(d.y, -1.0, 1.0)) / pi;\n"
+"    s = eyeRect.x + s * eyeRect.z;\n"
+"    t = eyeRect.y + t * eyeRect.w;\n"
+"    t = mix(t, 1.0 - t, flipY);\n"
+"    lowp vec4 texColor = texture(samImage, vec2(s, t));\n"
+"    gl_FragColor = vec4(texColor.rgb, color.a); \n"
+"}\n"
+"\n";
+
 #if 0
 static constexpr char vertexShaderSourceCubeDebug[] =
 "attribute highp vec4 vCoord;\n"
@@ -97,31 +195,103 @@ static constexpr char fragmentShaderSourceCubeDebug[] =
 "}\n"
 "\n";
 #endif
+// The cube map is sampled with the direction of the fragment from the center of the cube.
+// x is mirrored, as the faces are seen from inside the cube. See also glCubeMapFace.
 static constexpr char vertexShaderSourceCube[] =
 "attribute highp vec4 vCoord;\n"
-"attribute highp vec2 vTexCoord;\n"
 "uniform highp mat4 matrix;\n"
-"varying highp vec2 texCoord;\n"
+"varying highp vec3 texDir;\n"
 "void main()\n"
 "{\n"
-"    texCoord = vTexCoord.xy;\n"
+"    texDir = vec3(-vCoord.x, vCoord.y, vCoord.z);\n"
 "    gl_Position = matrix * vCoord;\n"
 "}\n"
 "\n";
 
 static constexpr char fragmentShaderSourceCube[] =
-"#define texture texture2D\n"
-"varying highp vec2 texCoord;\n"
+"varying highp vec3 texDir;\n"
 "uniform highp vec4 color;\n"
-"uniform sampler2D samImage; \n"
+"uniform samplerCube samCube; \n"
 "void main()\n"
 "{\n"
-"    highp vec4 texColor = texture(samImage, texCoord.xy);\n"
+"    highp vec4 texColor = textureCube(samCube, texDir);\n"
 "    gl_FragColor = vec4(texColor.rgb, color.a); \n"
 "}\n"
 "\n";
 const char *cubeVertex = vertexShaderSourceCube;
 const char *cubeFragment = fragmentShaderSourceCube;
+
+#ifndef GL_TEXTURE_CUBE_MAP_SEAMLESS
+#define GL_TEXTURE_CUBE_MAP_SEAMLESS 0x884F
+#endif
+#ifndef GL_MAX_CUBE_MAP_TEXTURE_SIZE
+#define GL_MAX_CUBE_MAP_TEXTURE_SIZE 0x851C
+#endif
+#ifndef GL_CONSTANT_ALPHA
+#define GL_CONSTANT_ALPHA 0x8003
+#endif
+#ifndef GL_ONE_MINUS_CONSTANT_ALPHA
+#define GL_ONE_MINUS_CONSTANT_ALPHA 0x8004
+#endif
+#ifndef GL_NUM_COMPRESSED_TEXTURE_FORMATS
+#define GL_NUM_COMPRESSED_TEXTURE_FORMATS 0x86A2
+#endif
+#ifndef GL_COMPRESSED_TEXTURE_FORMATS
+#define GL_COMPRESSED_TEXTURE_FORMATS 0x86A3
+#endif
+
+/// Returns the face of the GL cube map texture a CubeFace is uploaded to.
+/// X faces are swapped, to match the mirrored lookup in vertexShaderSourceCube.
+QOpenGLTexture::CubeMapFace glCubeMapFace(CubeFace face)
+{
+    switch (face) {
+    case CubeFace::PX:
+        return QOpenGLTexture::CubeMapNegativeX;
+    case CubeFace::MX:
+        return QOpenGLTexture::CubeMapPositiveX;
+    case CubeFace::PY:
+        return QOpenGLTexture::CubeMapPositiveY;
+    case CubeFace::MY:
+        return QOpenGLTexture::CubeMapNegativeY;
+    case CubeFace::PZ:
+        return QOpenGLTexture::CubeMapPositiveZ;
+    case CubeFace::MZ:
+    default:
+        return QOpenGLTexture::CubeMapNegativeZ;
+    }
+}
+
+/// Sizes and allocates texture for the format and levels of data.
+/// Mip maps can't be generated for compressed formats, so only the ones in data are used.
+/// OpenGL ES 2 has no GL_TEXTURE_MAX_LEVEL, and a partial chain there leaves the texture
+/// mipmap incomplete, so it is only sampled with mip maps if data has all the levels.
+void allocateCompressedTexture(QOpenGLTexture *texture, const PhotoSphereCompressedTexture &data)
+{
+    texture->setFormat(QOpenGLTexture::TextureFormat(data.glInternalFormat()));
+    texture->setSize(data.width(), data.height());
+    texture->setMipLevels(data.levelCount());
+    texture->allocateStorage();
+    QOpenGLContext *ctx = QOpenGLContext::currentContext();
+    const bool partialChain = data.levelCount() < texture->maximumMipLevels();
+    const bool mipmapped = (data.levelCount() > 1)
+            && !(partialChain && ctx->isOpenGLES() && ctx->format().majorVersion() < 3);
+    texture->setMinificationFilter(mipmapped ? QOpenGLTexture::LinearMipMapLinear
+                                             : QOpenGLTexture::Linear);
+    texture->setMagnificationFilter(QOpenGLTexture::Linear);
+}
+
+/// Uploads all the levels of data to texture, to face if texture is a cube map
+void setCompressedTextureData(QOpenGLTexture *texture, const PhotoSphereCompressedTexture &data,
+                              QOpenGLTexture::CubeMapFace face = QOpenGLTexture::CubeMapPositiveX)
+{
+    for (int level = 0; level < data.levelCount(); ++level) {
+        const QByteArray bytes = data.level(level);
+        if (texture->target() == QOpenGLTexture::TargetCubeMap)
+            texture->setCompressedData(level, 0, face, bytes.size(), bytes.constData());
+        else
+            texture->setCompressedData(level, bytes.size(), bytes.constData());
+    }
+}
 }
 
 /// PhotoSphereRenderState holds the state of the PhotoSphere (where is the user looking)
@@ -132,127 +302,185 @@ struct PhotoSphereRenderState {
     {
         return azimuth == o.azimuth
                 && elevation == o.elevation
+                && orientation == o.orientation
                 && fov == o.fov
                 && viewportHeight == o.viewportHeight
                 && viewportWidth == o.viewportWidth
-                && source.isSharedWith(o.source)
-                && sourceCube.isSharedWith(o.sourceCube)
-                && maxTexSize == o.maxTexSize;
+                && sourceId == o.sourceId
+                && tilesGeneration == o.tilesGeneration
+                && maxTexSize == o.maxTexSize
+                && rayCasting == o.rayCasting
+                && stereoMode == o.stereoMode
+                && stereoSource == o.stereoSource
+                && renderScale == o.renderScale
+                && devicePixelRatio == o.devicePixelRatio
+                && sourceReleased == o.sourceReleased;
     }
 
     float azimuth = 0;
     float elevation = 0;
+    QQuaternion orientation; // the latest sensor sample, see QmlPhotoSphere::setSensorOrientation
     float fov = 90;
     int viewportWidth = 0;
     int viewportHeight = 0;
-    QByteArray source;
-    QMap<CubeFace, QByteArray> sourceCube;
+    QImage source; // decoded in QmlPhotoSphere's worker jobs
+    PhotoSphereCompressedTexture sourceCompressed; // instead of source, for KTX sources
+    QMap<CubeFace, QImage> sourceCube;
+    QMap<CubeFace, PhotoSphereCompressedTexture> sourceCubeCompressed;
+    PhotoSphereTileLayout tileLayout;
+    QHash<PhotoSphereTileId, QImage> tiles; // the loaded ones
+    quint64 tilesGeneration = 0;
     int maxTexSize = std::numeric_limits<int>::max();
+    bool rayCasting = false;
+    QmlPhotoSphere::StereoMode stereoMode = QmlPhotoSphere::NoStereo;
+    bool stereoSource = false; // equirectangular sources with the left eye on top of the right one
+    qreal renderScale = 1.0; // of the FBO, relative to the item size
+    qreal devicePixelRatio = 1.0;
+    // Identifies the sources above, which are only ever assigned together, with a new id:
+    // comparing states costs the same whatever the size of the sources.
+    quint64 sourceId = 0;
+    bool sourceReleased = false; // the item dropped the sources, see QmlPhotoSphere::lowMemoryMode
 };
 
-/// This utility struct encapsulates the geometry of a sphere and
-/// OpenGL code for rendering it. Assumes appropriate shader and
-/// texture unit to be bound.
-
-struct Sphere3D
+/// PhotoSphereLoad tracks an in-flight source assignment, until all its images are decoded.
+/// Equirectangular sources use a single image, cube maps use one image per CubeFace.
+struct PhotoSphereLoad
 {
-    Sphere3D()
+    ~PhotoSphereLoad()
     {
-        generateSphere();
+        for (const auto &c : qAsConst(connections))
+            QObject::disconnect(c);
     }
 
-    void generateSphere()
-    {
-        static constexpr double step = 0.015625; // 32 stacks, 64 sectors
+    quint64 id = 0;
+    RendererType type = RendererType::SphereRenderer;
+    QVector<QSharedPointer<PhotoSphereImage>> images;
+    QVector<QMetaObject::Connection> connections;
+    int maxTexSize = std::numeric_limits<int>::max();
+};
 
-        static constexpr double pi = M_PI;
-        static constexpr double pi2 =  2.0 * pi;
-        static constexpr double di = step;
-        static constexpr double dj = step * 2.0;
-        static constexpr double du = di * 2.0 * pi;
-        static constexpr double dv = dj * pi;
+/// PhotoSphereTiles holds the state of a tiled source in QmlPhotoSphere: the tiles loaded
+/// or being loaded, and the ones the renderer needs for the current view.
+struct PhotoSphereTiles
+{
+    PhotoSphereTileLayout layout;
+    QHash<PhotoSphereTileId, QSharedPointer<PhotoSphereImage>> requests;
+    QHash<PhotoSphereTileId, QImage> images; // the loaded ones
+    QHash<PhotoSphereTileId, quint64> lastNeeded;
+    QVector<PhotoSphereTileId> needed; // set by the renderer in synchronize, by priority
+    quint64 clock = 0;
+    quint64 generation = 0; // incremented when images change
+};
 
-        for (double i = 0; i < 1.0; i += di)  //horizonal
-        for (double j = 0; j < 1.0; j += dj)  //vertical
-        {
-            double u = (i * pi2) + (M_PI_2); // azimuth, rotated 90 degrees to make 0 point to north
-            double v = (M_PI_2) - j * pi;         // elevation
-
-            QVector3D bl(cos(u) * cos(v - dv),       sin(v - dv), -sin(u) * cos(v - dv));
-            QVector3D br(cos(u + du) * cos(v - dv),  sin(v - dv), -sin(u + du) * cos(v - dv));
-            QVector3D tr(cos(u + du) * cos(v),       sin(v),      -sin(u + du) * cos(v));
-            QVector3D tl(cos(u) * cos(v),            sin(v),      -sin(u) * cos(v));
-
-            // nullify zeroes
-            QList<QVector3D *> vtx;
-            vtx << &bl << &br << &tr << &tl;
-            for(auto v: vtx) {
-                for (auto c = 0 ; c < 3; ++c) {
-                    if (qFuzzyIsNull((*v)[c]))
-                        (*v)[c] = 0;
-                }
-            }
+/// PhotoSphereCubeMapUpload is the PhotoSphereTextureUpload of cube maps. Faces are uploaded
+/// one after the other, in the order given at each step, so that the ones in view come first.
+struct PhotoSphereCubeMapUpload
+{
+    PhotoSphereCubeMapUpload(const PhotoSphereTextureCache::Key &k, const QMap<CubeFace, QImage> &source,
+                             int size)
+        : key(k), faces(source), edge(size)
+    {
+        uploaded.fill(false);
+    }
 
-            QVector2D texBl(1.0 - i,        j + dj);
-            QVector2D texBr(1.0 - i - di,   j + dj);
-            QVector2D texTr(1.0 - i - di,   j);
-            QVector2D texTl(1.0 - i,        j);
+    /// Uploads the next bands of rows, of the face being uploaded, then of the first face of
+    /// order not uploaded yet, allocating the texture first.
+    /// Returns true once all faces are uploaded, and the mip maps generated.
+    bool step(QOpenGLFunctions *f, const QVector<CubeFace> &order)
+    {
+        if (!texture) {
+            texture.reset(new QOpenGLTexture(QOpenGLTexture::TargetCubeMap));
+            texture->setSize(edge, edge);
+            texture->setFormat(imageTextureFormat());
+            texture->setMipLevels(texture->maximumMipLevels());
+            texture->allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8);
+            texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+            // Only the first level has data until the end, see drawnTexture()
+            texture->setMinificationFilter(QOpenGLTexture::Linear);
+            texture->setMagnificationFilter(QOpenGLTexture::Linear);
+        }
 
-            m_sphereVertices << bl << tl << tr << bl << tr << br;
-            m_texCoords << texBl << texTl << texTr << texBl << texTr << texBr;
+        int budget = PhotoSphereTextureUpload::maxBytesPerFrame;
+        texture->bind();
+        while (budget > 0 && remaining > 0) {
+            if (current == CubeFace::InvalidFace)
+                startFace(order);
+            const int rows = qMin(qMax(1, budget / image.bytesPerLine()), edge - nextRow);
+            f->glTexSubImage2D(GLenum(glCubeMapFace(current)), 0, 0, nextRow, edge, rows,
+                               GL_RGBA, GL_UNSIGNED_BYTE, image.constScanLine(nextRow));
+            budget -= rows * image.bytesPerLine();
+            nextRow += rows;
+            if (nextRow == edge) {
+                uploaded[current] = true;
+                --remaining;
+                current = CubeFace::InvalidFace;
+                image = QImage();
+            }
         }
+        texture->release();
+        if (remaining > 0)
+            return false;
+
+        texture->generateMipMaps();
+        texture->setMaximumAnisotropy(16.0f);
+        texture->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
+        // ToDo: consider adding some LOD bias for improved sharpness
+        return true;
     }
 
-    void init()
+    /// true if all of faces have been uploaded
+    bool covers(const QVector<CubeFace> &faces) const
     {
-        if (m_initialized)
-            return;
-        m_initialized = true;
-        // vtx
-        m_vertexDataBuffer.create();
-        m_vertexDataBuffer.bind();
-        m_vertexDataBuffer.allocate(&m_sphereVertices.front(), m_sphereVertices.size() * sizeof(QVector3D));
-        m_vertexDataBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
-        m_vertexDataBuffer.release();
-        // texCoords
-        m_texCoordBuffer.create();
-        m_texCoordBuffer.bind();
-        m_texCoordBuffer.allocate(&m_texCoords.front(), m_texCoords.size() * sizeof(QVector2D));
-        m_texCoordBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
-        m_texCoordBuffer.release();
-
-        QOpenGLVertexArrayObject::Binder vaoBinder(&m_vao); // creates
-        QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
-        m_vertexDataBuffer.bind();
-        f->glEnableVertexAttribArray(0);
-        f->glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-        m_vertexDataBuffer.release();
-        m_texCoordBuffer.bind();
-        f->glEnableVertexAttribArray(1);
-        f->glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
-        m_texCoordBuffer.release();
+        for (CubeFace face : faces) {
+            if (!uploaded[face])
+                return false;
+        }
+        return true;
     }
 
-    void drawSphere()
+    PhotoSphereTextureCache::Key key;
+    QMap<CubeFace, QImage> faces;
+    int edge;
+    QScopedPointer<QOpenGLTexture> texture;
+    std::array<bool, CubeFace::InvalidFace> uploaded;
+    int remaining = CubeFace::InvalidFace;
+    bool drawn = false; // set once the faces in view are uploaded, drawn instead of the previous cube map
+
+private:
+    /// Picks the next face to upload, scaling it to the size of the texture if needed
+    void startFace(const QVector<CubeFace> &order)
     {
-        QOpenGLVertexArrayObject::Binder vaoBinder(&m_vao);
-        QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
-        f->glDrawArrays(GL_TRIANGLES, 0, m_sphereVertices.size());
+        for (CubeFace face : order) {
+            if (!uploaded[face]) {
+                current = face;
+                break;
+            }
+        }
+        for (int i = CubeFace::PX; current == CubeFace::InvalidFace; i++ ) {
+            if (!uploaded[i])
+                current = CubeFace(i);
+        }
+        image = faces.value(current);
+        if (image.isNull()) { // missing faces are left black
+            image = QImage(edge, edge, QImage::Format_RGBA8888);
+            image.fill(Qt::black);
+        }
+        if (image.size() != QSize(edge, edge))
+            image = image.scaled(edge, edge, Qt::IgnoreAspectRatio, Qt::FastTransformation);
+        image = std::move(image).convertToFormat(QImage::Format_RGBA8888); // already, unless scaled
+        nextRow = 0;
     }
 
-    QOpenGLVertexArrayObject m_vao;
-
-    QOpenGLBuffer m_vertexDataBuffer;
-    QOpenGLBuffer m_texCoordBuffer;
-    QVector<QVector3D> m_sphereVertices;
-    QVector<QVector2D> m_texCoords;
-
-    bool m_initialized = false;
+    CubeFace current = CubeFace::InvalidFace;
+    QImage image;
+    int nextRow = 0;
 };
 
 /// This utility struct encapsulates the geometry of a cube and
 /// OpenGL code for rendering it. Assumes appropriate shader and
-/// texture unit to be bound.
+/// cube map texture to be bound.
+/// Each face is stored as 2 triangles, in CubeFace order, so that faces
+/// can also be drawn individually.
 
 struct Cube3D
 {
@@ -275,17 +503,12 @@ struct Cube3D
         4, 5, 1, 0, // MX
         1, 5, 6, 2, // MY
         7, 6, 5, 4, // MZ
-      }},
-     m_texCoordsFace{{ // invert x when looking from inside
-       {1.0, 0.0},
-       {1.0, 1.0},
-       {0.0, 1.0},
-       {0.0, 0.0}
-     }}
+      }}
     {
-        for (int i = 0; i < int(m_indices.size()); ++i) {
-            m_vertices[i] = m_cubeVertices[m_indices[i]];
-            m_texCoords[i] = m_texCoordsFace[i % 4];
+        static constexpr std::array<int, 6> quadToTriangles {{ 0, 1, 2, 0, 2, 3 }};
+        for (int i = 0; i < int(m_vertices.size()); ++i) {
+            const int quad = i / 6;
+            m_vertices[i] = m_cubeVertices[m_indices[quad * 4 + quadToTriangles[i % 6]]];
         }
     }
 
@@ -300,70 +523,84 @@ struct Cube3D
         m_vertexDataBuffer.allocate(&m_vertices.front(), m_vertices.size() * sizeof(QVector3D));
         m_vertexDataBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
         m_vertexDataBuffer.release();
-        // texCoords
-        m_texCoordBuffer.create();
-        m_texCoordBuffer.bind();
-        m_texCoordBuffer.allocate(&m_texCoords.front(), m_texCoords.size() * sizeof(QVector2D));
-        m_texCoordBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
-        m_texCoordBuffer.release();
-        // VAOs
+        // VAO
+        QOpenGLVertexArrayObject::Binder vaoBinder(&m_vao); // creates
         QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
-        for (int i = CubeFace::PX; i != CubeFace::InvalidFace; i++ ) {
-            QOpenGLVertexArrayObject::Binder vaoBinder(&m_vao[i]); // creates
-            m_vertexDataBuffer.bind();
-            f->glEnableVertexAttribArray(0);
-            f->glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void *) (4 * i * sizeof (QVector3D)));
-            m_vertexDataBuffer.release();
-            m_texCoordBuffer.bind();
-            f->glEnableVertexAttribArray(1);
-            f->glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void *) (4 * i * sizeof (QVector2D)));
-            m_texCoordBuffer.release();
-            // VertexAttribIPointer not available in GLES2
-        }
+        m_vertexDataBuffer.bind();
+        f->glEnableVertexAttribArray(0);
+        f->glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        m_vertexDataBuffer.release();
+    }
+
+    /// Draw the whole cube with a single draw call
+    /// This method assumes texture data and relevant shader is bound
+    void draw()
+    {
+        QOpenGLVertexArrayObject::Binder vaoBinder(&m_vao);
+        QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+        f->glDrawArrays(GL_TRIANGLES, 0, int(m_vertices.size()));
     }
 
     /// Draw a face of the cube with OpenGL
     /// This method assumes texture data and relevant shader is bound
     void drawFace(CubeFace face)
     {
-        int faceId(face);
-        QOpenGLVertexArrayObject::Binder vaoBinder(&m_vao[faceId]);
+        QOpenGLVertexArrayObject::Binder vaoBinder(&m_vao);
+        QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+        f->glDrawArrays(GL_TRIANGLES, int(face) * 6, 6);
+    }
+
+    /// Like drawFace(), for several faces
+    void drawFaces(const QVector<CubeFace> &faces)
+    {
+        QOpenGLVertexArrayObject::Binder vaoBinder(&m_vao);
         QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
-        f->glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+        for (CubeFace face : faces)
+            f->glDrawArrays(GL_TRIANGLES, int(face) * 6, 6);
     }
 
-    // 6 VAOs, one per face
-    std::array<QOpenGLVertexArrayObject, 6> m_vao;
+    QOpenGLVertexArrayObject m_vao;
 
     QOpenGLBuffer m_vertexDataBuffer;
-    QOpenGLBuffer m_texCoordBuffer;
     float m_scale = 1.0f;
     std::array<QVector3D, 8> m_cubeVertices;
     std::array<quint16, 24> m_indices;
-    std::array<QVector2D, 4> m_texCoordsFace;
 
-    std::array<QVector3D, 24> m_vertices;
-    std::array<QVector2D, 24> m_texCoords;
+    std::array<QVector3D, 36> m_vertices;
 
     bool m_initialized = false;
 };
 
 // -- QQuickFramebufferObject::Renderer implementations start -- //
 
-/// Base class for QQuickFramebufferObject::Renderer encapsulating common code
+/// Base class of the renderers, one per source type, encapsulating common code.
+/// They are driven by PhotoSphereRendererPool, either into an FBO or directly.
 class PhotoSphereRendererBase
 {
+public:
+    virtual ~PhotoSphereRendererBase() = default;
+
 protected:
-    /// creates the framebuffer object with the desired format.
+    /// creates the framebuffer object with the desired format, scaled by the render scale.
     QOpenGLFramebufferObject *createFbo(const QSize &size)
     {
         QOpenGLFramebufferObjectFormat format;
-        format.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+        format.setAttachment(QOpenGLFramebufferObject::NoAttachment); // see beginFrame
         format.setSamples(1);
-        m_fbo =  new QOpenGLFramebufferObject(size, format);
+        const QSize scaledSize = (QSizeF(size) * m_state.renderScale).toSize().expandedTo(QSize(1, 1));
+        m_fbo =  new QOpenGLFramebufferObject(scaledSize, format);
         return m_fbo;
     }
 
+    /// true if the FBO has to be recreated for the current state
+    bool framebufferSizeChanged() const
+    {
+        return m_state.viewportHeight != m_oldState.viewportHeight
+                || m_state.viewportWidth != m_oldState.viewportWidth
+                || m_state.renderScale != m_oldState.renderScale
+                || m_state.devicePixelRatio != m_oldState.devicePixelRatio;
+    }
+
     /// called in synchronize, pulls the state from QmlPhotoSphere into a PhotoSphereRenderState struct
     void updateState(QQuickFramebufferObject *item)
     {
@@ -371,12 +608,33 @@ protected:
         m_oldState = m_state;
         m_state.azimuth = itm->azimuth();
         m_state.elevation = itm->elevation();
+        m_state.orientation = itm->takeSensorOrientation();
         m_state.fov = itm->fieldOfView();
         m_state.viewportWidth = itm->width();
         m_state.viewportHeight = itm->height();
         m_state.source = itm->m_image;
+        m_state.sourceCompressed = itm->m_compressedImage;
         m_state.sourceCube = itm->m_cubeMap;
+        m_state.sourceCubeCompressed = itm->m_compressedCubeMap;
+        if (itm->m_tiles) {
+            m_state.tileLayout = itm->m_tiles->layout;
+            m_state.tiles = itm->m_tiles->images;
+            m_state.tilesGeneration = itm->m_tiles->generation;
+        } else {
+            m_state.tileLayout = PhotoSphereTileLayout();
+            m_state.tiles.clear();
+        }
         m_state.maxTexSize = qMin(m_glMaxTexSize, itm->m_maximumTextureSize);
+        m_state.rayCasting = itm->m_rayCasting;
+        m_state.stereoMode = itm->m_stereoMode;
+        m_state.stereoSource = itm->m_stereoSource;
+        m_state.renderScale = (itm->m_interacting && !m_direct) ? itm->m_interactiveRenderScale : 1.0;
+        m_state.devicePixelRatio = itm->window() ? itm->window()->effectiveDevicePixelRatio() : 1.0;
+        m_state.sourceId = itm->m_sourceId;
+        if (m_state.sourceId != m_oldState.sourceId)
+            m_uploadTime = 0;
+        m_state.sourceReleased = itm->m_sourceReleased;
+        m_residentSourceId = itm->m_residentSourceId;
 
         if (itm->m_glMaxTexSize != m_glMaxTexSize) {
             // sadly init has no access to item, so we need to run this if at every update
@@ -389,24 +647,184 @@ protected:
         }
     }
 
+    /// Prepares the render target for drawing a frame. The own FBO is cleared, the scene graph
+    /// render target is left as it is, as the panorama covers the whole item anyway.
+    /// Nothing is depth tested: panoramas are seen from their center, so their faces never
+    /// overlap, and the FBO has no depth or stencil buffer.
+    void beginFrame(QOpenGLFunctions *f)
+    {
+        if (!m_direct) {
+            f->glClearColor(0, 0, 0, 0);
+            f->glClear(GL_COLOR_BUFFER_BIT);
+        }
+        f->glDisable(GL_DEPTH_TEST);
+        f->glDepthMask(false);
+    }
+
+    /// Leaves the GL state as expected by whoever draws next. After drawing into the own FBO,
+    /// the whole context is reset for the scene graph. Drawing directly, the render target, and
+    /// whatever the scene graph or the QQuickWidget, layer or QQuickRenderControl around it keep
+    /// bound, must stay as they are. Only the bindings made here are undone, as they have no
+    /// flag in changedStates(). The rest is reported there, see PhotoSphereRenderNode.
+    void endFrame(QOpenGLFunctions *f)
+    {
+        if (!m_direct) {
+            if (m_window)
+                m_window->resetOpenGLState();
+            return;
+        }
+        f->glUseProgram(0);
+        f->glBindBuffer(GL_ARRAY_BUFFER, 0);
+        f->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        f->glActiveTexture(GL_TEXTURE0);
+        f->glBindTexture(GL_TEXTURE_2D, 0);
+        f->glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    }
+
+    /// Uniform locations of a shader program, looked up once after linking it.
+    /// The uniforms that never change are set there too.
+    struct ShaderUniforms
+    {
+        void init(QOpenGLShaderProgram *program, const char *sampler, const QColor &color)
+        {
+            matrix = program->uniformLocation("matrix");
+            flipY = program->uniformLocation("flipY");
+            eyeRect = program->uniformLocation("eyeRect");
+            program->bind();
+            program->setUniformValue(sampler, 0);
+            program->setUniformValue("color", color);
+            program->setUniformValue(eyeRect, QVector4D(0, 0, 1, 1)); // the whole image
+            program->release();
+        }
+
+        int matrix = -1;
+        int flipY = -1; // -1 if not in the program, ignored by setUniformValue
+        int eyeRect = -1;
+    };
+
+    /// The size of the view of each eye, in item coordinates, see QmlPhotoSphere::stereoMode
+    QSizeF eyeSize() const
+    {
+        QSizeF size(m_state.viewportWidth, m_state.viewportHeight);
+        if (m_state.stereoMode == QmlPhotoSphere::SideBySide)
+            size.rwidth() *= 0.5;
+        else if (m_state.stereoMode == QmlPhotoSphere::TopBottom)
+            size.rheight() *= 0.5;
+        return size;
+    }
+
+    /// The aspect ratio of the view of each eye
+    float aspectRatio() const
+    {
+        const QSizeF size = eyeSize();
+        return float(size.width() / size.height());
+    }
+
+    /// Calls draw once per eye, the left one first, each time with the viewport set to the
+    /// half of the current one showing that eye, or only once, without stereoMode.
+    /// Both eyes share m_mvp: panoramas are at infinity, without parallax between the eyes.
+    void drawEyes(QOpenGLFunctions *f, const std::function<void(int eye)> &draw)
+    {
+        if (m_state.stereoMode == QmlPhotoSphere::NoStereo) {
+            draw(0);
+            return;
+        }
+        GLint viewport[4];
+        f->glGetIntegerv(GL_VIEWPORT, viewport);
+        // The top of the item is the bottom of the viewport, unless drawing flipped, see m_clipFlip
+        const bool flipped = m_clipFlip(1, 1) < 0;
+        for (int eye = 0; eye < 2; ++eye) {
+            if (m_state.stereoMode == QmlPhotoSphere::SideBySide) {
+                const int width = viewport[2] / 2;
+                f->glViewport(viewport[0] + eye * width, viewport[1], width, viewport[3]);
+            } else {
+                const int height = viewport[3] / 2;
+                const int half = flipped ? 1 - eye : eye;
+                f->glViewport(viewport[0], viewport[1] + half * height, viewport[2], height);
+            }
+            draw(eye);
+        }
+        f->glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    }
+
     /// called in init of the subclasses
     void initBase(QOpenGLFunctions *f, QQuickWindow *w)
     {
         f->glGetIntegerv(GL_MAX_TEXTURE_SIZE, &m_glMaxTexSize);
+        GLint numCompressedFormats = 0;
+        f->glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &numCompressedFormats);
+        QVector<GLint> compressedFormats(numCompressedFormats);
+        if (numCompressedFormats > 0)
+            f->glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, compressedFormats.data());
+        for (GLint format : qAsConst(compressedFormats))
+            m_glCompressedFormats.insert(format);
         m_shader = new QOpenGLShaderProgram;
         m_window = w;
     }
 
+    /// Returns true if texture can be uploaded as is, warning about why not otherwise
+    bool canUploadCompressed(const PhotoSphereCompressedTexture &texture, int maxSize) const
+    {
+        if (!m_glCompressedFormats.contains(GLint(texture.glInternalFormat()))) {
+            qWarning() << "Compressed texture format not supported by the GPU: 0x"
+                       << QByteArray::number(texture.glInternalFormat(), 16);
+            return false;
+        }
+        if (texture.width() > maxSize || texture.height() > maxSize) {
+            qWarning() << "Compressed texture larger than the maximum texture size: "<< texture.size();
+            return false;
+        }
+        return true;
+    }
+
     virtual void init(QOpenGLFunctions *f, QQuickWindow *w) = 0;
+    /// Called with the item locked, copies its state over to the render thread
+    virtual void synchronize(QQuickFramebufferObject *item) = 0;
+    virtual void render() = 0;
+    /// Drops the references to the textures of the source
+    virtual void releaseTextures() = 0;
+
+    /// Tells the item the textures of the current sources exist, so it can drop its copies
+    void reportResident()
+    {
+        if (m_residentSourceId)
+            m_residentSourceId->storeRelease(m_state.sourceId);
+    }
+
+    /// Adds the time since timer was started to the upload time of the current source
+    void addUploadTime(const QElapsedTimer &timer)
+    {
+        m_uploadTime += timer.nsecsElapsed() / 1e6;
+    }
+
+    /// The GPU memory used by the textures of the current source, see PhotoSphereStats
+    virtual qint64 textureBytes() const = 0;
+
+    /// Asks the item to load again the sources it dropped, as their textures are gone
+    void requestSourceRestore(QQuickFramebufferObject *item)
+    {
+        QMetaObject::invokeMethod(item, "restoreSource", Qt::QueuedConnection);
+    }
+
+    /// Called when the renderer is no longer the current one, keeping shaders and buffers
+    /// but not its textures, that would otherwise be out of reach of the texture cache budget.
+    /// The state is reset too, for everything to count as changed at the next synchronize.
+    void reset()
+    {
+        releaseTextures();
+        m_state = m_oldState = PhotoSphereRenderState();
+    }
 
     /// encapsulate common code in synchronize. returns false if rest is to be skipped
-    bool synchronize(QQuickFramebufferObject *item)
+    bool synchronizeBase(QQuickFramebufferObject *item)
     {
         QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
         init(f, item->window());
         updateState(item);
 
-        return !(m_state == m_oldState);
+        const bool changed = !(m_state == m_oldState);
+        m_renderPending |= changed;
+        return changed;
     }
 
     QOpenGLShaderProgram *m_shader = nullptr;
@@ -414,123 +832,261 @@ protected:
     PhotoSphereRenderState m_state, m_oldState;
     QOpenGLFramebufferObject *m_fbo = nullptr;
     int m_glMaxTexSize = std::numeric_limits<int>::max();
+    QSet<GLint> m_glCompressedFormats;
     QMatrix4x4 m_mvp;
+    bool m_direct = false; // drawing into the scene graph render target, see PhotoSphereRenderNode
+    QMatrix4x4 m_clipFlip; // applied after m_mvp, to draw upright where the FBO would be mirrored
+    bool m_fboInvalid = false; // set in synchronize, if the FBO has to be recreated
+    bool m_updateRequested = false; // set in render, if another frame is needed
+    bool m_renderPending = false; // if the last frame drawn is out of date
+    qreal m_uploadTime = 0; // spent uploading the textures of the current source, in ms
+    QSharedPointer<QAtomicInteger<quint64>> m_residentSourceId; // shared with the item
+
+    friend class PhotoSphereRendererPool;
+    friend class PhotoSphereFboRenderer;
+    friend class PhotoSphereRenderNode;
 };
 
 
-/// Subclass of QQuickFramebufferObject::Renderer to render equirectangular images
-class PhotoSphereRenderer : public PhotoSphereRendererBase, public QQuickFramebufferObject::Renderer
+/// Renderer for equirectangular images
+class PhotoSphereRenderer : public PhotoSphereRendererBase
 {
 public:
     PhotoSphereRenderer() { }
 
     ~PhotoSphereRenderer() override
     {
-        delete m_texPhotoSphere;
-    }
-
-    QOpenGLFramebufferObject *createFramebufferObject(const QSize &size) override
-    {
-        return createFbo(size);
     }
 
     void render() override
     {
         QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+        if (m_sourceDirty || m_upload) {
+            QElapsedTimer uploadTimer;
+            uploadTimer.start();
+            if (m_sourceDirty)
+                uploadTexture();
+            if (m_upload)
+                continueUpload(f);
+            addUploadTime(uploadTimer);
+        }
 
-        const bool texturing = m_texPhotoSphere->isStorageAllocated() && m_texPhotoSphere->width() > 1;
+        const bool texturing = m_texPhotoSphere
+                && m_texPhotoSphere->isStorageAllocated() && m_texPhotoSphere->width() > 1;
 
-        f->glClearColor(0, 0, 0, 0);
-        f->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-        f->glEnable(GL_DEPTH_TEST);
-        f->glDepthFunc(GL_LESS);
-        f->glDepthMask(true);
+        if (m_state.rayCasting)
+            initRayCasting(f);
+        else
+            m_sphere.init();
+        beginFrame(f);
 
-        m_shader->bind();
-        m_shader->setUniformValue("matrix", m_mvp);
-        m_shader->setUniformValue("samImage", 0);
-        m_shader->setUniformValue("color", QColor(0,0,0,255));
+        QOpenGLShaderProgram *shader = m_state.rayCasting ? m_rayCastShader.data() : m_shader;
+        const ShaderUniforms &uniforms = m_state.rayCasting ? m_rayCastUniforms : m_uniforms;
+        shader->bind();
+        shader->setUniformValue(uniforms.matrix, m_state.rayCasting ? m_rayMatrix * m_clipFlip
+                                                                    : m_clipFlip * m_mvp);
+        shader->setUniformValue(uniforms.flipY, m_flipY ? 1.0f : 0.0f);
 
         if (texturing)
             m_texPhotoSphere->bind(0);
-        m_sphere.drawSphere();
+        drawEyes(f, [&](int eye) {
+            shader->setUniformValue(uniforms.eyeRect, m_state.stereoSource ? QVector4D(0, eye * 0.5f, 1, 0.5f)
+                                                                           : QVector4D(0, 0, 1, 1));
+            if (m_state.rayCasting) {
+                QOpenGLVertexArrayObject::Binder vaoBinder(&m_rayCastVao);
+                f->glDrawArrays(GL_TRIANGLES, 0, 3);
+            } else {
+                m_sphere.drawSphere();
+            }
+        });
         if (texturing)
             m_texPhotoSphere->release();
 
-        m_shader->release();
+        shader->release();
 
-        if (m_window)
-            m_window->resetOpenGLState();
+        endFrame(f);
     }
 
     // It is called in updatePaintNode, so to copy data over to the render thread while
     // it is locked.
     void synchronize(QQuickFramebufferObject *item) override
     {
-        if (!PhotoSphereRendererBase::synchronize(item))
+        if (!synchronizeBase(item))
             return;
 
-        if (m_state.viewportHeight != m_oldState.viewportHeight
-                || m_state.viewportWidth != m_oldState.viewportWidth)
-            invalidateFramebufferObject();
+        if (framebufferSizeChanged())
+            m_fboInvalid = true;
 
-        const float ar = float(m_state.viewportWidth) / float(m_state.viewportHeight);
+        const float ar = aspectRatio();
 
         QMatrix4x4 matProjection;
         matProjection.perspective(m_state.fov, ar, 0.001, 200);
 
-        QMatrix4x4 matAzimuth;
-        matAzimuth.rotate(m_state.azimuth, 0, 1, 0);
+        const QMatrix4x4 matView = viewMatrix(m_state.azimuth, m_state.elevation, m_state.orientation);
+        m_mvp = matProjection * matView;
+
+        // The inverse of the rotation part of m_mvp, applied to the view direction through
+        // each point of the clip space
+        const float tanV = std::tan(qDegreesToRadians(m_state.fov) * 0.5f);
+        QMatrix4x4 matRays;
+        matRays.scale(tanV * ar, tanV, 1);
+        m_rayMatrix = matView.inverted() * matRays;
+
+        // The source is already decoded, just flag it for upload in render(),
+        // to not hold the GUI thread for it. Once released, the texture created before is drawn.
+        if (m_state.sourceReleased) {
+            if (!m_texPhotoSphere && !m_upload)
+                requestSourceRestore(item);
+        } else if (m_oldState.sourceId != m_state.sourceId) {
+            m_sourceDirty = true;
+        }
+    }
 
-        QMatrix4x4 matElevation;
-        matElevation.rotate(m_state.elevation, -1, 0, 0);
+protected:
+    qint64 textureBytes() const override
+    {
+        return m_texPhotoSphere ? PhotoSphereTextureCache::textureBytes(m_texPhotoSphere.data()) : 0;
+    }
 
+    void releaseTextures() override
+    {
+        m_texPhotoSphere.reset();
+        m_upload.reset();
+        m_sourceDirty = false;
+    }
 
-        m_mvp = QMatrix4x4()
-                * matProjection
-                * matElevation
-                * matAzimuth
-                ;
+    /// Gets the texture for the source from the texture cache. If not there, it is uploaded
+    /// over the next frames by continueUpload(), the current texture being drawn until then.
+    void uploadTexture()
+    {
+        m_sourceDirty = false;
+        m_upload.reset();
+        if (!m_state.sourceCompressed.isNull()) {
+            uploadCompressedTexture();
+            return;
+        }
+        const QImage source = m_state.source;
+        if (source.isNull() || !source.width() || !source.height())
+            return;
 
-        if (m_oldState.source != m_state.source) {
-            auto image = QImage::fromData(m_state.source);
-            if (image.isNull() || !image.width() || !image.height())
-                return;
-            m_texPhotoSphere->destroy();
-            if (image.width() > m_glMaxTexSize)
-                image = image.scaledToWidth(m_glMaxTexSize, Qt::FastTransformation);
+        const PhotoSphereTextureCache::Key key {source.cacheKey()};
+        const QSharedPointer<QOpenGLTexture> cached =
+                PhotoSphereTextureCache::texture(key, []() -> QOpenGLTexture * { return nullptr; });
+        if (cached) {
+            m_texPhotoSphere = cached;
+            m_flipY = false;
+            reportResident();
+            return;
+        }
+
+        QImage image = source;
+        if (image.width() > m_glMaxTexSize) // decoded before the GL limit was known
+            image = image.scaledToWidth(m_glMaxTexSize, Qt::FastTransformation);
+        m_upload.reset(new PhotoSphereTextureUpload(key, image));
+    }
 
-            m_texPhotoSphere->setData(image);
-            m_texPhotoSphere->setAutoMipMapGenerationEnabled(true);
-            m_texPhotoSphere->setMaximumAnisotropy(16.0f);
-            m_texPhotoSphere->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
-            m_texPhotoSphere->setMagnificationFilter(QOpenGLTexture::Linear);
+    /// Uploads the next band of rows of m_upload, and puts the texture in the cache once complete
+    void continueUpload(QOpenGLFunctions *f)
+    {
+        if (!m_upload->step(f)) {
+            m_updateRequested = true;
+            return;
         }
+
+        QOpenGLTexture *texture = m_upload->texture.take();
+        bool inserted = false;
+        m_texPhotoSphere = PhotoSphereTextureCache::texture(m_upload->key, [texture, &inserted]() {
+            inserted = true;
+            return texture;
+        });
+        if (!inserted) // uploaded meanwhile by another render thread
+            delete texture;
+        m_flipY = false;
+        m_upload.reset();
+        reportResident();
     }
 
-protected:
     void init(QOpenGLFunctions *f, QQuickWindow *w) override
     {
         if (!m_shader) {
             initBase(f, w);
-            m_sphere.init();
 
             // Create shaders
             m_shader->addShaderFromSourceCode(QOpenGLShader::Vertex, QByteArray(vertexShaderSourceSphere));
             m_shader->addShaderFromSourceCode(QOpenGLShader::Fragment, QByteArray(fragmentShaderSourceSphere));
             m_shader->bindAttributeLocation("vCoord", 0);
             m_shader->link();
-
-            m_texPhotoSphere = new QOpenGLTexture(QOpenGLTexture::Target2D);
+            m_uniforms.init(m_shader, "samImage", QColor(0, 0, 0, 255));
         }
     }
 
+    /// Like uploadTexture(), for compressed sources. These are uploaded as they are.
+    void uploadCompressedTexture()
+    {
+        const PhotoSphereCompressedTexture source = m_state.sourceCompressed;
+        m_texPhotoSphere.reset();
+        if (!canUploadCompressed(source, m_glMaxTexSize))
+            return;
+
+        m_flipY = !source.isTopDown();
+        m_texPhotoSphere = PhotoSphereTextureCache::texture({source.cacheKey()}, [source]() {
+            QOpenGLTexture *texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+            allocateCompressedTexture(texture, source);
+            setCompressedTextureData(texture, source);
+            texture->setMaximumAnisotropy(16.0f);
+            return texture;
+        });
+        if (m_texPhotoSphere)
+            reportResident();
+    }
+
+    /// Creates the shader and the full screen triangle used for ray casting, the first time
+    void initRayCasting(QOpenGLFunctions *f)
+    {
+        if (m_rayCastShader)
+            return;
+
+        QOpenGLContext *ctx = QOpenGLContext::currentContext();
+        QByteArray fragmentSource;
+        if (!ctx->isOpenGLES() || ctx->format().majorVersion() >= 3)
+            fragmentSource = "#define HAS_DERIVATIVES\n";
+        else if (ctx->hasExtension("GL_OES_standard_derivatives"))
+            fragmentSource = "#extension GL_OES_standard_derivatives : enable\n#define HAS_DERIVATIVES\n";
+        fragmentSource += fragmentShaderSourceSphereRayCast;
+
+        m_rayCastShader.reset(new QOpenGLShaderProgram);
+        m_rayCastShader->addShaderFromSourceCode(QOpenGLShader::Vertex, QByteArray(vertexShaderSourceSphereRayCast));
+        m_rayCastShader->addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentSource);
+        m_rayCastShader->bindAttributeLocation("vCoord", 0);
+        m_rayCastShader->link();
+        m_rayCastUniforms.init(m_rayCastShader.data(), "samImage", QColor(0, 0, 0, 255));
+
+        // A triangle covering the whole clip space
+        static constexpr GLfloat vertices[] = { -1, -1,  3, -1,  -1, 3 };
+        m_rayCastVertices.create();
+        m_rayCastVertices.bind();
+        m_rayCastVertices.allocate(vertices, sizeof(vertices));
+        QOpenGLVertexArrayObject::Binder vaoBinder(&m_rayCastVao); // creates
+        f->glEnableVertexAttribArray(0);
+        f->glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+        m_rayCastVertices.release();
+    }
+
     Sphere3D m_sphere;
-    QOpenGLTexture *m_texPhotoSphere = nullptr;
+    QSharedPointer<QOpenGLTexture> m_texPhotoSphere;
+    QScopedPointer<PhotoSphereTextureUpload> m_upload;
+    bool m_sourceDirty = false;
+    bool m_flipY = false;
+    ShaderUniforms m_uniforms;
+    QScopedPointer<QOpenGLShaderProgram> m_rayCastShader;
+    ShaderUniforms m_rayCastUniforms;
+    QOpenGLBuffer m_rayCastVertices;
+    QOpenGLVertexArrayObject m_rayCastVao;
+    QMatrix4x4 m_rayMatrix;
 };
 
-/// Subclass of QQuickFramebufferObject::Renderer to render cube maps
-class PhotoSphereRendererCube : public PhotoSphereRendererBase, public QQuickFramebufferObject::Renderer
+/// Renderer for cube maps
+class PhotoSphereRendererCube : public PhotoSphereRendererBase
 {
 public:
     PhotoSphereRendererCube() { }
@@ -540,72 +1096,60 @@ public:
     {
     }
 
-    QOpenGLFramebufferObject *createFramebufferObject(const QSize &size) override
-    {
-        return createFbo(size);
-    }
-
     void render() override
     {
         QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
-        f->glClearColor(0, 0, 0, 0);
-        f->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-        f->glEnable(GL_DEPTH_TEST);
-        f->glDepthFunc(GL_LESS);
-        f->glDepthMask(true);
+        if (m_sourceDirty || m_upload) {
+            QElapsedTimer uploadTimer;
+            uploadTimer.start();
+            if (m_sourceDirty)
+                uploadTextures();
+            if (m_upload)
+                continueUpload(f);
+            addUploadTime(uploadTimer);
+        }
+        beginFrame(f);
 
         m_shader->bind();
-        m_shader->setUniformValue("matrix", m_mvp);
-
-        m_shader->setUniformValue("samImage", 0);
+        m_shader->setUniformValue(m_uniforms.matrix, m_clipFlip * m_mvp);
 
-        for (int i = CubeFace::PX; i != CubeFace::InvalidFace; i++ ) {
-            CubeFace face = CubeFace(i);
-//            m_shader->setUniformValue("color", faceColors.at(i));
-            const auto &tex = m_texFaces.value(face);
-            const bool texturing = tex->isStorageAllocated() && tex->width() > 1;
-            if (texturing)
-                tex->bind(0);
-            m_shader->setUniformValue("color", QColor(255,255,255));
-            m_cube.drawFace(face);
-            if (texturing)
-                tex->release();
-        }
+        // Only the faces intersecting the view
+        QOpenGLTexture *texture = drawnTexture();
+        const bool texturing = texture && texture->isStorageAllocated() && texture->width() > 1;
+        if (texturing)
+            texture->bind(0);
+        drawEyes(f, [this](int) { m_cube.drawFaces(m_visibleFaces); });
+        if (texturing)
+            texture->release();
 
         m_shader->release();
 
-        if (m_window)
-            m_window->resetOpenGLState();
+        endFrame(f);
     }
 
     void synchronize(QQuickFramebufferObject *item) override
     {
-        if (!PhotoSphereRendererBase::synchronize(item))
+        if (!synchronizeBase(item))
             return;
 
-        if (m_state.viewportHeight != m_oldState.viewportHeight
-                || m_state.viewportWidth != m_oldState.viewportWidth)
-            invalidateFramebufferObject();
+        if (framebufferSizeChanged())
+            m_fboInvalid = true;
 
-        const float ar = float(m_state.viewportWidth) / float(m_state.viewportHeight);
+        const float ar = aspectRatio();
 
         QMatrix4x4 matProjection;
         matProjection.perspective(m_state.fov, ar, 0.001, 200);
 
+        const QMatrix4x4 matView = viewMatrix(m_state.azimuth, m_state.elevation, m_state.orientation);
+        m_mvp = matProjection * matView;
+        m_visibleFaces = visibleFaces(matView, m_state.fov, ar);
+
+#if 0
+        // cube testing
         QMatrix4x4 matAzimuth;
         matAzimuth.rotate(m_state.azimuth, 0, 1, 0);
-
         QMatrix4x4 matElevation;
         matElevation.rotate(m_state.elevation, -1, 0, 0);
-
-        m_mvp = QMatrix4x4()
-                * matProjection
-                * matElevation
-                * matAzimuth
-                ;
-
-#if 0
-        // cube testing
         matProjection.setToIdentity();
         matProjection.ortho(-2,2,-2,2,-10,10);
         QMatrix4x4 matQuickize;
@@ -620,29 +1164,101 @@ public:
                 ;
 #endif
 
-        if (m_oldState.sourceCube != m_state.sourceCube
-                || m_oldState.maxTexSize != m_state.maxTexSize) { // reload all
-            // if here, sourceCube has been already validate in the setter
-            for (int i = CubeFace::PX; i != CubeFace::InvalidFace; i++ ) {
-                CubeFace face = CubeFace(i);
-                auto &t = m_texFaces[face];
-                t->destroy();
-                auto image = QImage::fromData(m_state.sourceCube.value(face));
-                int maxSz = qMin(m_state.maxTexSize, m_glMaxTexSize);
-                if (image.width() > maxSz)
-                    image = image.scaledToWidth(maxSz, Qt::FastTransformation);
-                t->setData(image);
-                t->setAutoMipMapGenerationEnabled(true);
-                t->setMaximumAnisotropy(16.0f);
-                t->setWrapMode(QOpenGLTexture::ClampToEdge);
-                t->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
-                t->setMagnificationFilter(QOpenGLTexture::Linear);
-                // ToDo: consider adding some LOD bias for improved sharpness
-            }
+        // if here, sourceCube has been already decoded and validated by the item.
+        // Upload is deferred to render(), to not hold the GUI thread for it.
+        // Once released, the texture created before is drawn.
+        if (m_state.sourceReleased) {
+            if (!m_texCube && !m_upload)
+                requestSourceRestore(item);
+        } else if (m_oldState.sourceId != m_state.sourceId) {
+            m_sourceDirty = true;
         }
     }
 
 protected:
+    qint64 textureBytes() const override
+    {
+        return m_texCube ? PhotoSphereTextureCache::textureBytes(m_texCube.data()) : 0;
+    }
+
+    void releaseTextures() override
+    {
+        m_texCube.reset();
+        m_upload.reset();
+        m_sourceDirty = false;
+    }
+
+    /// Gets the cube map texture for the six faces from the texture cache. If not there, it is
+    /// uploaded over the next frames by continueUpload(), the current texture being drawn until then.
+    /// Faces of a cube map have to be square and of the same size, so they are scaled if they aren't.
+    void uploadTextures()
+    {
+        m_sourceDirty = false;
+        m_upload.reset();
+        if (!m_state.sourceCubeCompressed.isEmpty()) {
+            uploadCompressedTextures();
+            return;
+        }
+        const QMap<CubeFace, QImage> faces = m_state.sourceCube;
+        const QImage first = faces.value(CubeFace::PX);
+        if (first.isNull())
+            return;
+
+        // Item decodes at the effective max size, unless the GL limit wasn't known yet
+        const int maxSz = qMin(qMin(m_state.maxTexSize, m_glMaxTexSize), m_glMaxCubeMapTexSize);
+        const int edge = qMin(qMin(first.width(), first.height()), maxSz);
+
+        PhotoSphereTextureCache::Key key;
+        for (const QImage &face : faces)
+            key.append(face.cacheKey());
+        key.append(edge);
+
+        const QSharedPointer<QOpenGLTexture> cached =
+                PhotoSphereTextureCache::texture(key, []() -> QOpenGLTexture * { return nullptr; });
+        if (cached) {
+            m_texCube = cached;
+            reportResident();
+            return;
+        }
+        m_upload.reset(new PhotoSphereCubeMapUpload(key, faces, edge));
+    }
+
+    /// Uploads the next bands of rows of m_upload, faces in view first, and puts the texture
+    /// in the cache once complete.
+    /// The previous cube map is drawn until all the faces in view are uploaded, then the new one
+    /// for all of them at once, never a mix of the two. Faces coming into view after the switch
+    /// are uploaded within the frame, as the previous cube map can't stand in for them anymore.
+    void continueUpload(QOpenGLFunctions *f)
+    {
+        bool complete = m_upload->step(f, m_visibleFaces);
+        while (!complete && m_upload->drawn && !m_upload->covers(m_visibleFaces))
+            complete = m_upload->step(f, m_visibleFaces);
+        if (!complete) {
+            m_upload->drawn = m_upload->drawn || m_upload->covers(m_visibleFaces);
+            m_updateRequested = true;
+            return;
+        }
+
+        QOpenGLTexture *texture = m_upload->texture.take();
+        bool inserted = false;
+        m_texCube = PhotoSphereTextureCache::texture(m_upload->key, [texture, &inserted]() {
+            inserted = true;
+            return texture;
+        });
+        if (!inserted) // uploaded meanwhile by another render thread
+            delete texture;
+        m_upload.reset();
+        reportResident();
+    }
+
+    /// The cube map being uploaded, once it is drawn (see continueUpload()), or the current one
+    QOpenGLTexture *drawnTexture() const
+    {
+        if (m_upload && m_upload->texture && m_upload->drawn)
+            return m_upload->texture.data();
+        return m_texCube.data();
+    }
+
     void init(QOpenGLFunctions *f, QQuickWindow *w) override
     {
         if (!m_shader) {
@@ -654,23 +1270,520 @@ protected:
             m_shader->addShaderFromSourceCode(QOpenGLShader::Fragment,
                                               QByteArray(cubeFragment));
             m_shader->bindAttributeLocation("vCoord", 0);
-            m_shader->bindAttributeLocation("vTexCoord", 1);
             m_shader->link();
+            m_uniforms.init(m_shader, "samCube", QColor(255, 255, 255));
+
+            f->glGetIntegerv(GL_MAX_CUBE_MAP_TEXTURE_SIZE, &m_glMaxCubeMapTexSize);
 
-            for (int i = CubeFace::PX; i != CubeFace::InvalidFace; i++ ) {
-                CubeFace face = CubeFace(i);
-                QSharedPointer<QOpenGLTexture> tex(
-                            new QOpenGLTexture(QOpenGLTexture::Target2D));
-                m_texFaces[face].swap(tex);
+            // Filter across face edges where available. Always the case in GLES 3
+            QOpenGLContext *ctx = QOpenGLContext::currentContext();
+            if (!ctx->isOpenGLES() && (ctx->format().version() >= qMakePair(3, 2)
+                                       || ctx->hasExtension("GL_ARB_seamless_cube_map")))
+                f->glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+        }
+    }
+
+    /// Like uploadTextures(), for compressed faces. These are uploaded as they are, so they
+    /// have to be already square, and of the same format, size and number of levels.
+    /// Cube map faces are stored top row first, so are the compressed faces by default.
+    void uploadCompressedTextures()
+    {
+        const QMap<CubeFace, PhotoSphereCompressedTexture> faces = m_state.sourceCubeCompressed;
+        const PhotoSphereCompressedTexture first = faces.value(CubeFace::PX);
+        m_texCube.reset();
+        if (faces.size() != CubeFace::InvalidFace) {
+            qWarning() << "Cube maps can't mix compressed and not compressed faces";
+            return;
+        }
+        if (!canUploadCompressed(first, qMin(m_glMaxTexSize, m_glMaxCubeMapTexSize)))
+            return;
+
+        PhotoSphereTextureCache::Key key;
+        for (const auto &face : faces) {
+            if (face.glInternalFormat() != first.glInternalFormat() || face.size() != first.size()
+                    || face.levelCount() != first.levelCount() || first.width() != first.height()) {
+                qWarning() << "Compressed cube map faces must be square, and of the same format, size and levels";
+                return;
             }
+            key.append(face.cacheKey());
         }
+
+        m_texCube = PhotoSphereTextureCache::texture(key, [faces, first]() {
+            QOpenGLTexture *texture = new QOpenGLTexture(QOpenGLTexture::TargetCubeMap);
+            allocateCompressedTexture(texture, first);
+            for (auto it = faces.cbegin(); it != faces.cend(); ++it)
+                setCompressedTextureData(texture, it.value(), glCubeMapFace(it.key()));
+            texture->setMaximumAnisotropy(16.0f);
+            texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+            return texture;
+        });
+        if (m_texCube)
+            reportResident();
     }
 
     Cube3D m_cube;
-    QMap<CubeFace, QSharedPointer<QOpenGLTexture>> m_texFaces;
+    ShaderUniforms m_uniforms;
+    QSharedPointer<QOpenGLTexture> m_texCube;
+    QScopedPointer<PhotoSphereCubeMapUpload> m_upload;
+    QVector<CubeFace> m_visibleFaces;
+    int m_glMaxCubeMapTexSize = std::numeric_limits<int>::max();
+    bool m_sourceDirty = false;
 };
 
 
+/// Subclass of QQuickFramebufferObject::Renderer to render multi-resolution tiled cube maps.
+/// Only the tiles intersecting the view are drawn, coarser levels first, so that tiles
+/// not loaded yet are covered by the coarser ones. The first level is always fully loaded.
+/// The tiles needed for the view are reported to the item, which streams them.
+class PhotoSphereRendererTiled : public PhotoSphereRendererBase
+{
+public:
+    PhotoSphereRendererTiled() { }
+
+    ~PhotoSphereRendererTiled() override
+    {
+    }
+
+    void render() override
+    {
+        const bool uploadsPending = uploadTiles();
+        if (m_geometryDirty)
+            updateGeometry();
+
+        QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+        // Tiles of all levels lie on the same surface, they are layered by drawing order
+        beginFrame(f);
+
+        m_shader->bind();
+        m_shader->setUniformValue(m_uniforms.matrix, m_clipFlip * m_mvp);
+
+        drawEyes(f, [this, f](int) {
+            QOpenGLVertexArrayObject::Binder vaoBinder(&m_vao);
+            for (int i = 0; i < m_drawnTextures.size(); ++i) {
+                const auto &texture = m_drawnTextures.at(i);
+                if (!texture)
+                    continue;
+                texture->bind(0);
+                f->glDrawArrays(GL_TRIANGLES, i * 6, 6);
+                texture->release();
+            }
+        });
+
+        m_shader->release();
+
+        endFrame(f);
+        m_updateRequested = uploadsPending;
+    }
+
+    void synchronize(QQuickFramebufferObject *item) override
+    {
+        if (!synchronizeBase(item))
+            return;
+
+        if (framebufferSizeChanged())
+            m_fboInvalid = true;
+
+        const float ar = aspectRatio();
+
+        QMatrix4x4 matProjection;
+        matProjection.perspective(m_state.fov, ar, 0.001, 200);
+
+        const QMatrix4x4 matView = viewMatrix(m_state.azimuth, m_state.elevation, m_state.orientation);
+        m_mvp = matProjection * matView;
+
+        const PhotoSphereTileLayout &layout = m_state.tileLayout;
+        QVector<PhotoSphereTileId> drawn;
+        QVector<PhotoSphereTileId> needed;
+        if (layout.isValid()) {
+            // Not loading finer levels than displayed, while interacting
+            const qreal dpr = m_state.devicePixelRatio * m_state.renderScale;
+            const int targetLevel = layout.levelFor(eyeSize().height() * dpr, m_state.fov);
+            QVector3D viewDir;
+            const qreal halfAngle = viewCone(matView, m_state.fov, ar, &viewDir);
+
+            needed = layout.tiles(0);
+            for (int level = 0; level <= targetLevel; ++level) {
+                const QVector<PhotoSphereTileId> visible = layout.visibleTiles(level, viewDir, halfAngle);
+                for (const auto &tile : visible) {
+                    if (m_state.tiles.contains(tile))
+                        drawn.append(tile);
+                }
+                if (level == targetLevel && level > 0)
+                    needed += visible;
+            }
+        }
+
+        if (drawn != m_drawnTiles) {
+            m_drawnTiles = drawn;
+            m_geometryDirty = true;
+        }
+
+        QmlPhotoSphere *itm = qobject_cast<QmlPhotoSphere *>(item);
+        if (itm->m_tiles && itm->m_tiles->needed != needed) {
+            itm->m_tiles->needed = needed;
+            QMetaObject::invokeMethod(itm, "updateTiles", Qt::QueuedConnection);
+        }
+    }
+
+protected:
+    /// Of the tiles drawn, the only ones kept
+    qint64 textureBytes() const override
+    {
+        qint64 bytes = 0;
+        for (const auto &texture : m_tileTextures)
+            bytes += PhotoSphereTextureCache::textureBytes(texture.data());
+        return bytes;
+    }
+
+    void init(QOpenGLFunctions *f, QQuickWindow *w) override
+    {
+        if (!m_shader) {
+            initBase(f, w);
+
+            m_shader->addShaderFromSourceCode(QOpenGLShader::Vertex, QByteArray(vertexShaderSourceSphere));
+            m_shader->addShaderFromSourceCode(QOpenGLShader::Fragment, QByteArray(fragmentShaderSourceSphere));
+            m_shader->bindAttributeLocation("vCoord", 0);
+            m_shader->bindAttributeLocation("vTexCoord", 1);
+            m_shader->link();
+            m_uniforms.init(m_shader, "samImage", QColor(0, 0, 0, 255)); // flipY stays 0
+
+            m_vertexBuffer.create();
+            m_vertexBuffer.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+            QOpenGLVertexArrayObject::Binder vaoBinder(&m_vao); // creates
+            m_vertexBuffer.bind();
+            f->glEnableVertexAttribArray(0);
+            f->glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), 0);
+            f->glEnableVertexAttribArray(1);
+            f->glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat),
+                                     (void *) (3 * sizeof(GLfloat)));
+            m_vertexBuffer.release();
+        }
+    }
+
+    void releaseTextures() override
+    {
+        m_drawnTiles.clear();
+        m_drawnTextures.clear();
+        m_tileTextures.clear();
+    }
+
+    /// Gets the textures of the tiles to draw, uploading at most maxUploadsPerFrame of them
+    /// not to stall the render thread. Returns true if some are left for the next frames.
+    bool uploadTiles()
+    {
+        static constexpr int maxUploadsPerFrame = 4;
+        QHash<qint64, QSharedPointer<QOpenGLTexture>> textures;
+        int uploads = 0;
+        bool pending = false;
+
+        m_drawnTextures.clear();
+        for (const auto &tile : qAsConst(m_drawnTiles)) {
+            const QImage image = m_state.tiles.value(tile);
+            if (image.isNull()) { // a compressed tile
+                m_drawnTextures.append(nullptr);
+                continue;
+            }
+            const qint64 key = image.cacheKey();
+            QSharedPointer<QOpenGLTexture> texture = m_tileTextures.value(key);
+            if (!texture && uploads < maxUploadsPerFrame) {
+                ++uploads;
+                QElapsedTimer uploadTimer;
+                uploadTimer.start();
+                texture = PhotoSphereTextureCache::texture({key}, [image]() {
+                    QOpenGLTexture *texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+                    texture->setData(image);
+                    texture->setAutoMipMapGenerationEnabled(true);
+                    texture->setMaximumAnisotropy(16.0f);
+                    texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+                    texture->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
+                    texture->setMagnificationFilter(QOpenGLTexture::Linear);
+                    return texture;
+                });
+                addUploadTime(uploadTimer);
+            } else if (!texture) {
+                pending = true;
+            }
+            if (texture)
+                textures.insert(key, texture);
+            m_drawnTextures.append(texture);
+        }
+        m_tileTextures = textures; // releases the ones no longer drawn
+        return pending;
+    }
+
+    /// Fills the vertex buffer with two triangles per drawn tile, in drawing order
+    void updateGeometry()
+    {
+        m_geometryDirty = false;
+        static constexpr std::array<int, 6> quadToTriangles {{ 0, 1, 2, 0, 2, 3 }};
+        // QOpenGLTexture::setData uploads the top row of the tile first, at t = 0
+        static constexpr std::array<std::array<GLfloat, 2>, 4> texCoords {{
+            {{0, 0}}, {{1, 0}}, {{1, 1}}, {{0, 1}}
+        }};
+
+        QVector<GLfloat> vertices;
+        vertices.reserve(m_drawnTiles.size() * 6 * 5);
+        for (const auto &tile : qAsConst(m_drawnTiles)) {
+            const QRectF r = m_state.tileLayout.tileRect(tile);
+            const std::array<QPointF, 4> corners {{ r.topLeft(), r.topRight(), r.bottomRight(), r.bottomLeft() }};
+            for (int corner : quadToTriangles) {
+                const QVector3D p = PhotoSphereTileLayout::facePoint(tile.face,
+                                                                     corners[corner].x(),
+                                                                     corners[corner].y());
+                vertices << p.x() << p.y() << p.z()
+                         << texCoords[corner][0] << texCoords[corner][1];
+            }
+        }
+
+        m_vertexBuffer.bind();
+        m_vertexBuffer.allocate(vertices.constData(), vertices.size() * int(sizeof(GLfloat)));
+        m_vertexBuffer.release();
+    }
+
+    QOpenGLVertexArrayObject m_vao;
+    QOpenGLBuffer m_vertexBuffer;
+    ShaderUniforms m_uniforms;
+    QVector<PhotoSphereTileId> m_drawnTiles; // coarser levels first
+    QVector<QSharedPointer<QOpenGLTexture>> m_drawnTextures; // same order, null if not uploaded yet
+    QHash<qint64, QSharedPointer<QOpenGLTexture>> m_tileTextures;
+    bool m_geometryDirty = false;
+};
+
+
+/// Holds one renderer per source type, created on first use, and forwards to the one for the
+/// current source of the item. Switching between equirectangular, cube map and tiled sources
+/// then costs only the texture swap, the shaders and buffers of the other renderers being kept.
+class PhotoSphereRendererPool
+{
+public:
+    explicit PhotoSphereRendererPool(bool direct) : m_direct(direct) { }
+
+    /// Synchronizes the renderer for the source type of item, making it the current one.
+    /// Returns true if the FBO has to be recreated.
+    bool synchronize(QQuickFramebufferObject *item)
+    {
+        const RendererType type = qobject_cast<QmlPhotoSphere *>(item)->m_rendererType;
+        std::unique_ptr<PhotoSphereRendererBase> &renderer = m_renderers[type];
+        if (!renderer) {
+            if (type == RendererType::CubeRenderer)
+                renderer.reset(new PhotoSphereRendererCube);
+            else if (type == RendererType::TiledRenderer)
+                renderer.reset(new PhotoSphereRendererTiled);
+            else
+                renderer.reset(new PhotoSphereRenderer);
+            renderer->m_direct = m_direct;
+        }
+        if (m_current && m_current != renderer.get())
+            m_current->reset();
+        m_current = renderer.get();
+
+        QElapsedTimer timer;
+        timer.start();
+        m_current->synchronize(item);
+        m_synchronizeTime += timer.nsecsElapsed() / 1e6;
+        ++m_synchronizeCount;
+        // Only compared with in synchronize. Not to keep the previous sources alive
+        m_current->m_oldState = m_current->m_state;
+        const bool fboInvalid = m_current->m_fboInvalid;
+        m_current->m_fboInvalid = false;
+        m_item = qobject_cast<QmlPhotoSphere *>(item);
+        return fboInvalid;
+    }
+
+    /// Renders with the current renderer. Returns true if another frame is needed.
+    /// Into an FBO, nothing is drawn if the state didn't change since the last frame, the FBO
+    /// keeping its contents: the item is also updated for changes not affecting the rendering.
+    bool render()
+    {
+        if (!m_current || (!m_direct && !m_current->m_renderPending))
+            return false;
+        QElapsedTimer timer;
+        timer.start();
+        m_current->render();
+        m_renderTime += timer.nsecsElapsed() / 1e6;
+        ++m_renderCount;
+        reportStats();
+        const bool updateRequested = m_current->m_updateRequested;
+        m_current->m_updateRequested = false;
+        m_current->m_renderPending = updateRequested;
+        return updateRequested;
+    }
+
+    PhotoSphereRendererBase *current() const { return m_current; }
+
+private:
+    /// Posts to the item the upload statistics of the current source, once uploaded, and the
+    /// frame averages every statsInterval. Tiles are streamed, so the statistics of tiled
+    /// sources keep changing.
+    void reportStats()
+    {
+        static constexpr qint64 statsInterval = 500; // ms
+        const quint64 sourceId = m_current->m_state.sourceId;
+        const bool uploaded = m_current == m_renderers[RendererType::TiledRenderer].get()
+                || (m_current->m_residentSourceId && m_current->m_residentSourceId->loadAcquire() == sourceId);
+        const qint64 textureBytes = uploaded ? m_current->textureBytes() : 0;
+        const QPointer<QmlPhotoSphere> item = m_item;
+        if (uploaded && (m_reportedSourceId != sourceId || m_reportedUploadTime != m_current->m_uploadTime
+                         || m_reportedTextureBytes != textureBytes)) {
+            m_reportedSourceId = sourceId;
+            m_reportedUploadTime = m_current->m_uploadTime;
+            m_reportedTextureBytes = textureBytes;
+            const qreal uploadTime = m_reportedUploadTime;
+            QMetaObject::invokeMethod(QCoreApplication::instance(), [item, sourceId, uploadTime, textureBytes]() {
+                if (item)
+                    item->setUploadStats(sourceId, uploadTime, textureBytes);
+            }, Qt::QueuedConnection);
+        }
+
+        if (!m_statsTimer.isValid())
+            m_statsTimer.start();
+        const qint64 elapsed = m_statsTimer.elapsed();
+        if (elapsed < statsInterval)
+            return;
+        PhotoSphereStats::Frames frames;
+        frames.synchronizeTime = m_synchronizeCount ? m_synchronizeTime / m_synchronizeCount : 0;
+        frames.renderTime = m_renderCount ? m_renderTime / m_renderCount : 0;
+        frames.frameRate = m_renderCount * 1000.0 / elapsed;
+        m_synchronizeTime = m_renderTime = 0;
+        m_synchronizeCount = m_renderCount = 0;
+        m_statsTimer.start();
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [item, frames]() {
+            if (item)
+                item->setFrameStats(frames);
+        }, Qt::QueuedConnection);
+    }
+
+    std::array<std::unique_ptr<PhotoSphereRendererBase>, 3> m_renderers; // by RendererType
+    PhotoSphereRendererBase *m_current = nullptr;
+    bool m_direct;
+    QPointer<QmlPhotoSphere> m_item; // only dereferenced in the GUI thread
+    quint64 m_reportedSourceId = 0;
+    qreal m_reportedUploadTime = 0;
+    qint64 m_reportedTextureBytes = 0;
+    QElapsedTimer m_statsTimer; // of the current interval of the frame averages
+    qreal m_synchronizeTime = 0;
+    int m_synchronizeCount = 0;
+    qreal m_renderTime = 0;
+    int m_renderCount = 0;
+};
+
+/// QQuickFramebufferObject::Renderer drawing the sources of the item into its FBO
+class PhotoSphereFboRenderer : public QQuickFramebufferObject::Renderer
+{
+public:
+    PhotoSphereFboRenderer() : m_renderers(false) { }
+
+    QOpenGLFramebufferObject *createFramebufferObject(const QSize &size) override
+    {
+        return m_renderers.current()->createFbo(size);
+    }
+
+    void synchronize(QQuickFramebufferObject *item) override
+    {
+        if (m_renderers.synchronize(item))
+            invalidateFramebufferObject();
+    }
+
+    void render() override
+    {
+        if (m_renderers.render())
+            update();
+    }
+
+private:
+    PhotoSphereRendererPool m_renderers;
+};
+
+/// Scene graph node drawing a renderer straight into the scene graph render target,
+/// instead of the renderer's own FBO composited by the scene graph afterwards.
+/// Drawing is limited to the item rectangle, mapped to the render target through the
+/// scene graph matrices, so the item must not be rotated, nor clipped.
+/// See QmlPhotoSphere::directRendering.
+class PhotoSphereRenderNode : public QSGRenderNode
+{
+public:
+    PhotoSphereRenderNode() : m_renderers(true) { }
+
+    void synchronize(QmlPhotoSphere *item)
+    {
+        m_size = item->size();
+        m_renderers.synchronize(item);
+    }
+
+    void render(const RenderState *state) override
+    {
+        PhotoSphereRendererBase *renderer = m_renderers.current();
+        if (!renderer)
+            return;
+        QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+
+        // the item rectangle in normalized device coordinates, and then in the render target
+        const QMatrix4x4 toClip = *state->projectionMatrix() * *matrix();
+        const QPointF topLeft = toClip.map(QPointF(0, 0));
+        const QPointF bottomRight = toClip.map(QPointF(m_size.width(), m_size.height()));
+        GLint viewport[4];
+        f->glGetIntegerv(GL_VIEWPORT, viewport);
+        const QRectF ndc = QRectF(topLeft, bottomRight).normalized();
+        f->glViewport(qRound(viewport[0] + (ndc.left() + 1.0) * 0.5 * viewport[2]),
+                      qRound(viewport[1] + (ndc.top() + 1.0) * 0.5 * viewport[3]),
+                      qRound(ndc.width() * 0.5 * viewport[2]),
+                      qRound(ndc.height() * 0.5 * viewport[3]));
+
+        // Renderers draw upside down, for the FBO to be mirrored
+        renderer->m_clipFlip.setToIdentity();
+        if (topLeft.y() > bottomRight.y())
+            renderer->m_clipFlip.scale(1, -1, 1);
+
+        // the clip state the scene graph passes to the node, if any
+        if (state->scissorEnabled()) {
+            const QRect r = state->scissorRect();
+            f->glEnable(GL_SCISSOR_TEST);
+            f->glScissor(r.x(), r.y(), r.width(), r.height());
+        } else {
+            f->glDisable(GL_SCISSOR_TEST);
+        }
+        if (state->stencilEnabled()) {
+            f->glEnable(GL_STENCIL_TEST);
+            f->glStencilFunc(GL_EQUAL, state->stencilValue(), 0xff);
+            f->glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        } else {
+            f->glDisable(GL_STENCIL_TEST);
+        }
+
+        if (inheritedOpacity() < 1.0) {
+            f->glEnable(GL_BLEND);
+            f->glBlendColor(0, 0, 0, float(inheritedOpacity()));
+            f->glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+        } else {
+            f->glDisable(GL_BLEND);
+        }
+
+        if (m_renderers.render() && renderer->m_window)
+            renderer->m_window->update();
+    }
+
+    /// The program, buffer and texture bindings are restored by the renderers, see endFrame().
+    /// The vertex array objects are released as soon as drawn.
+    StateFlags changedStates() const override
+    {
+        return DepthState | StencilState | ScissorState | BlendState | ViewportState;
+    }
+
+    RenderingFlags flags() const override
+    {
+        return BoundedRectRendering;
+    }
+
+    QRectF rect() const override
+    {
+        return QRectF(QPointF(0, 0), m_size);
+    }
+
+private:
+    PhotoSphereRendererPool m_renderers;
+    QSizeF m_size;
+};
+
 
 /*
  *
@@ -687,6 +1800,12 @@ protected:
     \brief The PhotoSphere type displays a spherical panorama, provided in
     form of an equirectangular image, or the six separate images of a cube map.
 
+    PhotoSphere is OpenGL only: it renders with OpenGL, ES 2.0 or later, and
+    requires the OpenGL scene graph backend, the default one. Other backends,
+    like the software one selected with QT_QUICK_BACKEND=software, or
+    Direct3D 12, are not supported: nothing is drawn, and a warning is
+    printed.
+
     \section2 Example Usage
 
     The following snippet shows a PhotoSphere containing elements to handle
@@ -758,11 +1877,27 @@ protected:
     \endcode
 */
 QmlPhotoSphere::QmlPhotoSphere(QQuickItem *parent) : QQuickFramebufferObject(parent)
-  , m_recreateRenderer(false)
 {
   setFlag(ItemHasContents);
-  setTextureFollowsItemSize(true);
+  // The renderers recreate their FBO on size changes, as it may be smaller than the item,
+  // see interactiveRenderScale
+  setTextureFollowsItemSize(false);
   setMirrorVertically(true);
+
+  m_residentSourceId.reset(new QAtomicInteger<quint64>(0));
+  connect(this, &QQuickItem::windowChanged, this, &QmlPhotoSphere::watchResidency);
+
+  m_interactionTimer.setSingleShot(true);
+  connect(&m_interactionTimer, &QTimer::timeout, this, [this]() {
+      m_interacting = false;
+      updateSphere();
+  });
+
+  m_viewAnimation.setEasingCurve(QEasingCurve::InOutQuad);
+  connect(&m_viewAnimation, &QVariantAnimation::valueChanged, this, [this](const QVariant &value) {
+      const QVector3D view = value.value<QVector3D>();
+      applyView(view.x(), view.y(), view.z());
+  });
 }
 
 QmlPhotoSphere::~QmlPhotoSphere()
@@ -777,19 +1912,8 @@ qreal QmlPhotoSphere::azimuth() const
 
 void QmlPhotoSphere::setAzimuth(qreal azimuth)
 {
-    if (!qIsFinite(azimuth))
-            return;
-
-    azimuth = std::fmod(azimuth, qreal(360.0));
-    if (azimuth < 0.0)
-        azimuth += 360.0;
-
-    if (azimuth == m_azimuth)
-        return;
-
-    m_azimuth = azimuth;
-    updateSphere();
-    emit azimuthChanged(azimuth);
+    m_viewAnimation.stop();
+    applyView(azimuth, m_elevation, m_fieldOfView);
 }
 
 qreal QmlPhotoSphere::elevation() const
@@ -799,13 +1923,8 @@ qreal QmlPhotoSphere::elevation() const
 
 void QmlPhotoSphere::setElevation(qreal elevation)
 {
-    if (elevation == m_elevation || !qIsFinite(elevation))
-        return;
-
-    elevation = qBound<double>(-90.0, elevation, 90.0);
-    m_elevation = elevation;
-    updateSphere();
-    emit elevationChanged(elevation);
+    m_viewAnimation.stop();
+    applyView(m_azimuth, elevation, m_fieldOfView);
 }
 
 qreal QmlPhotoSphere::fieldOfView() const
@@ -815,41 +1934,118 @@ qreal QmlPhotoSphere::fieldOfView() const
 
 void QmlPhotoSphere::setFieldOfView(qreal fov)
 {
-    if (fov == m_fieldOfView || fov < 3.0 || fov > 150.0) // arbitrary selection of FOVs.
-        return;                                           // >150 gets hard to look at
+    m_viewAnimation.stop();
+    applyView(m_azimuth, m_elevation, fov);
+}
+
+void QmlPhotoSphere::setView(qreal azimuth, qreal elevation, qreal fieldOfView, int duration)
+{
+    m_viewAnimation.stop();
+    if (duration <= 0) {
+        applyView(azimuth, elevation, fieldOfView);
+        return;
+    }
 
-    m_fieldOfView = fov;
+    // Invalid values are kept as they are, also while animating
+    if (!qIsFinite(azimuth))
+        azimuth = m_azimuth;
+    if (!qIsFinite(elevation))
+        elevation = m_elevation;
+    if (!(fieldOfView >= 3.0 && fieldOfView <= 150.0))
+        fieldOfView = m_fieldOfView;
+    qreal delta = std::fmod(azimuth - m_azimuth, qreal(360.0));
+    if (delta > 180.0)
+        delta -= 360.0;
+    else if (delta < -180.0)
+        delta += 360.0;
+
+    m_viewAnimation.setStartValue(QVector3D(m_azimuth, m_elevation, m_fieldOfView));
+    m_viewAnimation.setEndValue(QVector3D(m_azimuth + delta, qBound<qreal>(-90.0, elevation, 90.0),
+                                          fieldOfView));
+    m_viewAnimation.setDuration(duration);
+    m_viewAnimation.start();
+}
+
+/// Sets the view with a single update, emitting the change signals of the properties that changed.
+/// Azimuth is wrapped, elevation is clamped, invalid values are ignored.
+void QmlPhotoSphere::applyView(qreal azimuth, qreal elevation, qreal fov)
+{
+    bool azimuthUpdated = false;
+    if (qIsFinite(azimuth)) {
+        azimuth = std::fmod(azimuth, qreal(360.0));
+        if (azimuth < 0.0)
+            azimuth += 360.0;
+        azimuthUpdated = azimuth != m_azimuth;
+        m_azimuth = azimuth;
+    }
+
+    bool elevationUpdated = false;
+    if (qIsFinite(elevation)) {
+        elevation = qBound<double>(-90.0, elevation, 90.0);
+        elevationUpdated = elevation != m_elevation;
+        m_elevation = elevation;
+    }
+
+    bool fovUpdated = false;
+    if (fov >= 3.0 && fov <= 150.0) { // arbitrary selection of FOVs. >150 gets hard to look at
+        fovUpdated = fov != m_fieldOfView;
+        m_fieldOfView = fov;
+    }
+
+    if (!azimuthUpdated && !elevationUpdated && !fovUpdated)
+        return;
+    noteInteraction();
     updateSphere();
-    emit fieldOfViewChanged(fov);
+    if (azimuthUpdated)
+        emit azimuthChanged(m_azimuth);
+    if (elevationUpdated)
+        emit elevationChanged(m_elevation);
+    if (fovUpdated)
+        emit fieldOfViewChanged(m_fieldOfView);
 }
 
-QVariant QmlPhotoSphere::source() const
+void QmlPhotoSphere::setSensorOrientation(const QQuaternion &orientation)
 {
-    if (!m_cubeMapUrls.isEmpty())
-        return m_cubeMapUrls;
-    return m_imageUrl;
+    {
+        QMutexLocker locker(&m_sensorMutex);
+        if (orientation == m_sensorOrientation)
+            return;
+        m_sensorOrientation = orientation;
+    }
+    // At most one update per frame, as the flag is cleared when the orientation is rendered
+    if (!m_sensorUpdatePending.testAndSetOrdered(0, 1))
+        return;
+    if (QThread::currentThread() == thread()) {
+        noteInteraction();
+        updateSphere();
+    } else {
+        QMetaObject::invokeMethod(this, [this]() {
+            noteInteraction();
+            updateSphere();
+        }, Qt::QueuedConnection);
+    }
 }
 
-static QByteArray fetchUrl(const QUrl &url)
+QQuaternion QmlPhotoSphere::sensorOrientation() const
 {
-    QNetworkRequest request;
-    request.setUrl(url);
-    QEventLoop syncLoop;
-    QScopedPointer<QNetworkAccessManager> nam(new QNetworkAccessManager);
+    QMutexLocker locker(&m_sensorMutex);
+    return m_sensorOrientation;
+}
 
-    QNetworkReply *reply = nam->get(request);
-    if (!reply->isFinished()) {
-        QObject::connect(reply, SIGNAL(finished()), &syncLoop, SLOT(quit()));
-        syncLoop.exec();
+/// Called by the renderers in synchronize. Orientations set from now on trigger a new update.
+QQuaternion QmlPhotoSphere::takeSensorOrientation()
+{
+    m_sensorUpdatePending.storeRelease(0);
+    return sensorOrientation();
+}
 
-        if (!reply->isFinished()) {
-            // This shouldn't happen
-            qWarning() << "Unfinished reply";
-            return QByteArray();
-        }
-    }
-    reply->deleteLater();
-    return reply->readAll();
+QVariant QmlPhotoSphere::source() const
+{
+    if (!m_tiledSource.isEmpty())
+        return m_tiledSource;
+    if (!m_cubeMapUrls.isEmpty())
+        return m_cubeMapUrls;
+    return m_imageUrl;
 }
 
 bool QmlPhotoSphere::loadFromUrl(const QString &url)
@@ -857,7 +2053,7 @@ bool QmlPhotoSphere::loadFromUrl(const QString &url)
     if (url.isEmpty())
         return false;
 
-    if (url == m_imageUrl)
+    if (url == m_imageUrl && m_status != Error) // loaded again after an error, as a retry
         return true;
 
     QUrl u(url);
@@ -866,26 +2062,12 @@ bool QmlPhotoSphere::loadFromUrl(const QString &url)
         return false;
     }
 
-    /*
-        Load the image
-    */
-
-    QByteArray data = fetchUrl(u);
-    QImage image;
-    if (!image.loadFromData(data)) {
-        qWarning() << "QImage::loadFromData failed for "<< u;
-        return false;
-    }
-
-    if (image.isNull() || !image.width() || !image.height()) {
-        qWarning() << "Empty image at "<< u;
-        return false;
-    }
-
     m_imageUrl = url;
-    m_image = data;
-
-    updateSphere();
+    m_cubeMapUrls.clear();
+    m_tiledSource.clear();
+    startLoad((m_cubeMapConversion == NoConversion) ? RendererType::SphereRenderer
+                                                    : RendererType::CubeRenderer, {u});
+    startPreviewLoad();
     emit sourceChanged();
     return true;
 }
@@ -894,7 +2076,7 @@ bool QmlPhotoSphere::loadFromCubeMap(const QVariantMap &cubeMap)
 {
     if (!cubeMap.size())
         return false;
-    if (m_cubeMapUrls == cubeMap)
+    if (m_cubeMapUrls == cubeMap && m_status != Error)
         return true;
     QSet<QString> keys = cubeMap.keys().toSet();
     static const QList<QString> requiredKeys{
@@ -910,63 +2092,524 @@ bool QmlPhotoSphere::loadFromCubeMap(const QVariantMap &cubeMap)
             return false;
         }
     }
+
+    QVector<QUrl> urls(CubeFace::InvalidFace);
     for (auto k: requiredKeys) {
         QUrl u(cubeMap.value(k).value<QString>());
         if (!u.isValid())
             return false;
+        urls[nameToCubeFace().value(k)] = u;
     }
 
-    QMap<CubeFace, QByteArray> cubeMapImages;
-    for (auto k: requiredKeys) {
-        QUrl u(cubeMap.value(k).value<QString>());
-        QByteArray data = fetchUrl(u);
-        QImage image;
-        if (!image.loadFromData(data)) {
-            qWarning() << "QImage::loadFromData failed for "<< u;
+    m_cubeMapUrls = cubeMap;
+    m_imageUrl.clear();
+    m_tiledSource.clear();
+    startLoad(RendererType::CubeRenderer, urls);
+    startPreviewLoad();
+    emit sourceChanged();
+    return true;
+}
+
+/// Loads the first level of a tiled source. The other levels are streamed
+/// by updateTiles(), as the renderer requests them.
+bool QmlPhotoSphere::loadFromTiles(const QVariantMap &map)
+{
+    if (m_tiledSource == map && m_status != Error)
+        return true;
+
+    const PhotoSphereTileLayout layout = PhotoSphereTileLayout::fromVariantMap(map);
+    if (!layout.isValid()) {
+        qWarning() << "Invalid tiled source. tileUrl, tileSize and levels are required";
+        return false;
+    }
+
+    QVector<QUrl> urls;
+    for (const auto &tile : layout.tiles(0)) {
+        const QUrl u = layout.tileUrl(tile);
+        if (!u.isValid())
             return false;
+        urls.append(u);
+    }
+
+    m_tiledSource = map;
+    m_imageUrl.clear();
+    m_cubeMapUrls.clear();
+    startLoad(RendererType::TiledRenderer, urls);
+    startPreviewLoad();
+    emit sourceChanged();
+    return true;
+}
+
+/// Starts loading urls through PhotoSphereImageCache, superseding any load still in progress.
+/// Images already loaded or being loaded, by this or other items, are shared.
+/// The currently displayed panorama is replaced only once all the images are decoded.
+/// A cube map load of a single url is an equirectangular image to be converted.
+/// The faces of cube maps in view are fetched and decoded first, as the last image requested
+/// is decoded first, and the other faces with low priority.
+void QmlPhotoSphere::startLoad(RendererType type, const QVector<QUrl> &urls)
+{
+    QScopedPointer<PhotoSphereLoad> load(new PhotoSphereLoad);
+    load->id = ++m_loadId;
+    load->type = type;
+    load->maxTexSize = effectiveMaximumTextureSize();
+    const PhotoSphereImage::Conversion conversion = (type == RendererType::CubeRenderer && urls.size() == 1)
+            ? imageConversion(m_cubeMapConversion) : PhotoSphereImage::NoConversion;
+
+    QVector<int> order(urls.size());
+    std::iota(order.begin(), order.end(), 0);
+    QVector<CubeFace> inView;
+    if (type == RendererType::CubeRenderer && urls.size() == CubeFace::InvalidFace) {
+        const qreal ar = (width() > 0 && height() > 0) ? width() / height() : 1.0;
+        inView = visibleFaces(viewMatrix(m_azimuth, m_elevation, sensorOrientation()), m_fieldOfView, ar);
+        std::stable_sort(order.begin(), order.end(), [&inView](int a, int b) {
+            return inView.contains(CubeFace(b)) && (!inView.contains(CubeFace(a))
+                    || inView.indexOf(CubeFace(a)) > inView.indexOf(CubeFace(b)));
+        });
+    }
+
+    const quint64 loadId = load->id;
+    load->images.resize(urls.size());
+    for (int i : qAsConst(order)) {
+        const PhotoSphereImage::Priority priority = (inView.isEmpty() || inView.contains(CubeFace(i)))
+                ? PhotoSphereImage::NormalPriority : PhotoSphereImage::LowPriority;
+        const QSharedPointer<PhotoSphereImage> image =
+                PhotoSphereImageCache::instance()->image(urls.at(i), load->maxTexSize, priority, conversion);
+        load->images[i] = image;
+        load->connections.append(connect(image.data(), &PhotoSphereImage::progress,
+                                         this, [this, loadId]() { onLoadProgress(loadId); }));
+        load->connections.append(connect(image.data(), &PhotoSphereImage::finished,
+                                         this, [this, loadId]() { onLoadFinished(loadId); }));
+    }
+    // Replaced only now, so that images of the superseded load can be reused
+    m_load.reset(load.take());
+
+    setProgress(0);
+    setStatus(Loading);
+    onLoadFinished(loadId); // images could be all already cached
+}
+
+void QmlPhotoSphere::onLoadProgress(quint64 loadId)
+{
+    if (!m_load || m_load->id != loadId)
+        return;
+
+    qreal progress = 0;
+    for (const auto &image : qAsConst(m_load->images)) {
+        if (image->status() != PhotoSphereImage::Loading)
+            progress += 1.0;
+        else if (image->bytesTotal() > 0)
+            progress += qreal(image->bytesReceived()) / qreal(image->bytesTotal());
+    }
+    // Keep 1.0 for when the source is actually ready to be displayed
+    setProgress(qMin(progress / m_load->images.size(), qreal(0.99)));
+}
+
+void QmlPhotoSphere::onLoadFinished(quint64 loadId)
+{
+    if (!m_load || m_load->id != loadId)
+        return; // superseded
+
+    for (const auto &image : qAsConst(m_load->images)) {
+        if (image->status() == PhotoSphereImage::Error) {
+            m_load.reset();
+            m_previewLoad.reset();
+            setStatus(Error);
+            return;
+        }
+        if (image->status() == PhotoSphereImage::Loading) {
+            onLoadProgress(loadId);
+            return;
         }
+    }
 
-        if (image.isNull() || !image.width() || !image.height()) {
-            qWarning() << "Empty image at "<< u;
-            return false;
+    m_previewLoad.reset(); // not needed anymore
+    QScopedPointer<PhotoSphereLoad> load(m_load.take());
+    applyLoad(*load);
+
+    setProgress(1.0);
+    setStatus(Ready);
+    updateSphere();
+}
+
+/// Makes the images of a finished load the displayed ones
+void QmlPhotoSphere::applyLoad(const PhotoSphereLoad &load)
+{
+    RendererType type = load.type;
+    const bool converted = type == RendererType::CubeRenderer && load.images.size() == 1;
+    if (converted && load.images.first()->cubeFaces().isEmpty())
+        type = RendererType::SphereRenderer; // not converted, like compressed sources, or no longer requested
+
+    m_compressedImage = PhotoSphereCompressedTexture();
+    m_compressedCubeMap.clear();
+    if (type == RendererType::SphereRenderer) {
+        m_image = load.images.first()->image();
+        m_compressedImage = load.images.first()->compressed();
+        m_cubeMap.clear();
+        m_tiles.reset();
+    } else if (type == RendererType::TiledRenderer) {
+        m_tiles.reset(new PhotoSphereTiles);
+        m_tiles->layout = PhotoSphereTileLayout::fromVariantMap(m_tiledSource);
+        const QVector<PhotoSphereTileId> firstLevel = m_tiles->layout.tiles(0);
+        for (int i = 0; i < firstLevel.size(); ++i) {
+            m_tiles->requests.insert(firstLevel.at(i), load.images.at(i));
+            m_tiles->images.insert(firstLevel.at(i), load.images.at(i)->image());
+        }
+        m_image = QImage();
+        m_cubeMap.clear();
+    } else if (converted) {
+        m_cubeMap = load.images.first()->cubeFaces();
+        m_image = QImage();
+        m_tiles.reset();
+    } else {
+        QMap<CubeFace, QImage> cubeMapImages;
+        for (int i = CubeFace::PX; i != CubeFace::InvalidFace; i++ ) {
+            const auto &image = load.images.at(i);
+            if (image->compressed().isNull())
+                cubeMapImages[CubeFace(i)] = image->image();
+            else
+                m_compressedCubeMap[CubeFace(i)] = image->compressed();
         }
+        m_cubeMap = cubeMapImages;
+        m_image = QImage();
+        m_tiles.reset();
+    }
+    // The images of a load are fetched in parallel
+    m_loadStats = PhotoSphereStats::Load();
+    for (const auto &image : load.images) {
+        const PhotoSphereImage::Timings timings = image->timings();
+        m_loadStats.fetchTime = qMax(m_loadStats.fetchTime, timings.fetch);
+        m_loadStats.decodeTime += timings.decode;
+        m_loadStats.scaleTime += timings.scale;
+        m_loadStats.conversionTime += timings.conversion;
+    }
+    m_loadedImages = load.images;
+    m_sourceId = load.id;
+    publishStats();
+    m_sourceReleased = false;
+    m_releasedUrls.clear();
+
+    m_rendererType = type;
+    watchResidency();
+}
 
-        cubeMapImages[nameToCubeFace.value(k)] = data;
+/// With lowMemoryMode, waits for the renderer to have created the textures of the displayed
+/// source, checking after each frame, to then release the source.
+void QmlPhotoSphere::watchResidency()
+{
+    QObject::disconnect(m_frameSwappedConnection);
+    if (!m_lowMemoryMode || m_sourceReleased || m_load || !window()
+            || m_loadedImages.isEmpty() || m_rendererType == RendererType::TiledRenderer)
+        return;
+    // frameSwapped is emitted in the render thread
+    m_frameSwappedConnection = connect(window(), &QQuickWindow::frameSwapped, this, [this]() {
+        if (m_residentSourceId->loadAcquire() == m_sourceId)
+            releaseSource();
+    }, Qt::QueuedConnection);
+}
 
+/// Drops the images of the displayed source, decoded and encoded, once its textures exist.
+/// Only the urls are kept, for restoreSource() and redecode().
+void QmlPhotoSphere::releaseSource()
+{
+    QObject::disconnect(m_frameSwappedConnection);
+    if (m_sourceReleased || m_loadedImages.isEmpty())
+        return;
+    m_releasedUrls.clear();
+    for (const auto &image : qAsConst(m_loadedImages))
+        m_releasedUrls.append(image->url());
+    m_releasedMaxTexSize = m_loadedImages.first()->maxTexSize();
+    m_loadedImages.clear(); // deleted, unless other items use them
+    m_image = QImage();
+    m_compressedImage = PhotoSphereCompressedTexture();
+    m_cubeMap.clear();
+    m_compressedCubeMap.clear();
+    m_sourceReleased = true;
+    updateSphere();
+}
+
+/// Loads again the source released by releaseSource(), when the renderer no longer has
+/// its textures, e.g. once the OpenGL context has been lost.
+void QmlPhotoSphere::restoreSource()
+{
+    if (!m_sourceReleased || m_load)
+        return;
+    startLoad(m_rendererType, m_releasedUrls);
+}
+
+/// Starts loading previewSource, to be displayed until the source being loaded is ready.
+/// Does nothing if no source is being loaded, or the preview is already being loaded.
+void QmlPhotoSphere::startPreviewLoad()
+{
+    if (!m_load || m_previewSource.isEmpty()
+            || (m_previewLoad && m_previewLoad->images.first()->url() == QUrl(m_previewSource)))
+        return;
+
+    const QUrl u(m_previewSource);
+    if (!u.isValid()) {
+        qWarning() << "Attempting to load invalid preview URL: "<< u;
+        return;
     }
-    m_cubeMap = cubeMapImages;
-    m_cubeMapUrls = cubeMap;
 
+    QScopedPointer<PhotoSphereLoad> load(new PhotoSphereLoad);
+    load->id = ++m_loadId;
+    load->type = RendererType::SphereRenderer;
+    load->maxTexSize = effectiveMaximumTextureSize();
+
+    const quint64 loadId = load->id;
+    const QSharedPointer<PhotoSphereImage> image =
+            PhotoSphereImageCache::instance()->image(u, load->maxTexSize);
+    load->images.append(image);
+    load->connections.append(connect(image.data(), &PhotoSphereImage::finished,
+                                     this, [this, loadId]() { onPreviewFinished(loadId); }));
+    m_previewLoad.reset(load.take());
+    onPreviewFinished(loadId); // could be already cached
+}
+
+void QmlPhotoSphere::onPreviewFinished(quint64 loadId)
+{
+    if (!m_previewLoad || m_previewLoad->id != loadId || !m_load)
+        return; // superseded, or the source is already loaded
+
+    const QSharedPointer<PhotoSphereImage> &image = m_previewLoad->images.first();
+    if (image->status() == PhotoSphereImage::Loading)
+        return;
+
+    QScopedPointer<PhotoSphereLoad> load(m_previewLoad.take());
+    if (image->status() == PhotoSphereImage::Error) {
+        qWarning() << "Failed loading preview source: "<< image->url();
+        return;
+    }
+    applyLoad(*load); // status stays Loading, until the source is ready
     updateSphere();
-    emit sourceChanged();
-    return true;
+}
+
+/// Loads again the current source, and the one being loaded, if the maximum texture
+/// size they have been decoded for is no longer the effective one.
+void QmlPhotoSphere::redecode()
+{
+    if (!m_tiledSource.isEmpty())
+        return; // tiles are far smaller than any texture size limit
+    const int maxTexSize = effectiveMaximumTextureSize();
+    if (!m_load && m_sourceReleased) {
+        if (m_releasedMaxTexSize != maxTexSize)
+            startLoad(m_rendererType, m_releasedUrls);
+        return;
+    }
+    const QVector<QSharedPointer<PhotoSphereImage>> images = m_load ? m_load->images : m_loadedImages;
+    if (images.isEmpty() || images.first()->maxTexSize() == maxTexSize)
+        return;
+
+    QVector<QUrl> urls;
+    for (const auto &image : images)
+        urls.append(image->url());
+    startLoad(m_load ? m_load->type : m_rendererType, urls);
 }
 
 void QmlPhotoSphere::setSource(const QVariant &source)
 {
     if (source.canConvert<QString>()) {
         QString url = source.toString();
-        if (loadFromUrl(url)) {
-            if (m_rendererType != RendererType::SphereRenderer)
-                m_recreateRenderer = true;
-            m_rendererType = RendererType::SphereRenderer;
-            m_cubeMap.clear();
-            m_cubeMapUrls.clear();
-        } else {
+        if (!loadFromUrl(url))
             qWarning() << "Failed setting source property to invalid value: "<< url;
+    } else if (source.canConvert<QVariantMap>()) {
+        const QVariantMap map = source.value<QVariantMap>();
+        if (PhotoSphereTileLayout::isTiledSource(map)) {
+            if (!loadFromTiles(map))
+                qWarning() << "Failed setting source property to invalid value: "<< map;
+        } else if (!loadFromCubeMap(map)) {
+            qWarning() << "Failed setting source property to invalid value: "<< map;
+        }
+    }
+}
+
+/// Requests the tiles the renderer needs and are not loaded yet, and drops
+/// pending requests and loaded tiles no longer needed, least recently needed first.
+void QmlPhotoSphere::updateTiles()
+{
+    static constexpr int maxPendingTiles = 32;
+    static constexpr int maxCachedTiles = 128;
+    if (!m_tiles)
+        return;
+
+    PhotoSphereTiles &tiles = *m_tiles;
+    ++tiles.clock;
+    const int maxTexSize = effectiveMaximumTextureSize();
+    for (const auto &tile : qAsConst(tiles.needed)) {
+        tiles.lastNeeded.insert(tile, tiles.clock);
+        if (tiles.requests.contains(tile))
+            continue;
+
+        const QSharedPointer<PhotoSphereImage> image =
+                PhotoSphereImageCache::instance()->image(tiles.layout.tileUrl(tile), maxTexSize);
+        tiles.requests.insert(tile, image);
+        // Raw pointer in the capture, the connection is owned by the image itself
+        PhotoSphereImage *img = image.data();
+        const auto onFinished = [this, tile, img]() {
+            if (!m_tiles || m_tiles->requests.value(tile).data() != img)
+                return; // dropped, or source changed
+            if (img->status() == PhotoSphereImage::Ready) {
+                m_tiles->images.insert(tile, img->image());
+                ++m_tiles->generation;
+                updateSphere();
+            }
+        };
+        if (image->status() == PhotoSphereImage::Loading)
+            connect(img, &PhotoSphereImage::finished, this, onFinished);
+        else
+            onFinished();
+    }
+
+    const auto byLastNeeded = [&tiles](const PhotoSphereTileId &a, const PhotoSphereTileId &b) {
+        return tiles.lastNeeded.value(a) < tiles.lastNeeded.value(b);
+    };
+    const auto isUnneeded = [&tiles](const PhotoSphereTileId &tile) {
+        return tile.level > 0 && tiles.lastNeeded.value(tile) != tiles.clock;
+    };
+
+    QVector<PhotoSphereTileId> pending;
+    for (auto it = tiles.requests.cbegin(); it != tiles.requests.cend(); ++it) {
+        if (!tiles.images.contains(it.key()) && it.value()->status() == PhotoSphereImage::Loading)
+            pending.append(it.key());
+    }
+    if (pending.size() > maxPendingTiles) {
+        std::sort(pending.begin(), pending.end(), byLastNeeded);
+        for (int i = 0; i < pending.size() - maxPendingTiles; ++i) {
+            if (isUnneeded(pending.at(i)))
+                tiles.requests.remove(pending.at(i));
+        }
+    }
+
+    QVector<PhotoSphereTileId> loaded = tiles.images.keys().toVector();
+    if (loaded.size() > maxCachedTiles) {
+        std::sort(loaded.begin(), loaded.end(), byLastNeeded);
+        bool removed = false;
+        for (int i = 0; i < loaded.size() - maxCachedTiles; ++i) {
+            const PhotoSphereTileId &tile = loaded.at(i);
+            if (!isUnneeded(tile))
+                continue;
+            tiles.images.remove(tile);
+            tiles.requests.remove(tile);
+            tiles.lastNeeded.remove(tile);
+            removed = true;
         }
+        if (removed)
+            ++tiles.generation;
+    }
+}
+
+QString QmlPhotoSphere::previewSource() const
+{
+    return m_previewSource;
+}
+
+void QmlPhotoSphere::prefetch(const QVariant &source)
+{
+    static constexpr int maxPrefetched = 8;
+    QVector<QUrl> urls;
+    PhotoSphereImage::Conversion conversion = PhotoSphereImage::NoConversion;
+    if (source.canConvert<QString>()) {
+        urls.append(QUrl(source.toString()));
+        conversion = imageConversion(m_cubeMapConversion);
     } else if (source.canConvert<QVariantMap>()) {
-        const QVariantMap cubeMap = source.value<QVariantMap>();
-        if (loadFromCubeMap(cubeMap)) {
-            if (m_rendererType != RendererType::CubeRenderer)
-                m_recreateRenderer = true;
-            m_rendererType = RendererType::CubeRenderer;
-            m_image.clear();
-            m_imageUrl.clear();
+        const QVariantMap map = source.value<QVariantMap>();
+        if (PhotoSphereTileLayout::isTiledSource(map)) {
+            const PhotoSphereTileLayout layout = PhotoSphereTileLayout::fromVariantMap(map);
+            if (layout.isValid()) {
+                for (const auto &tile : layout.tiles(0))
+                    urls.append(layout.tileUrl(tile));
+            }
         } else {
-            qWarning() << "Failed setting source property to invalid value: "<< cubeMap;
+            for (auto it = nameToCubeFace().cbegin(); it != nameToCubeFace().cend(); ++it)
+                urls.append(QUrl(map.value(it.key()).toString()));
         }
     }
+
+    QVector<QSharedPointer<PhotoSphereImage>> images;
+    for (const QUrl &url : qAsConst(urls)) {
+        if (url.isEmpty() || !url.isValid()) {
+            qWarning() << "Attempting to prefetch invalid source: "<< source;
+            return;
+        }
+        images.append(PhotoSphereImageCache::instance()->image(url, effectiveMaximumTextureSize(),
+                                                               PhotoSphereImage::LowPriority, conversion));
+    }
+    if (images.isEmpty())
+        return;
+
+    m_prefetched.append(images);
+    while (m_prefetched.size() > maxPrefetched)
+        m_prefetched.removeFirst();
+}
+
+void QmlPhotoSphere::setPreviewSource(const QString &url)
+{
+    if (url == m_previewSource)
+        return;
+    m_previewSource = url;
+    m_previewLoad.reset();
+    startPreviewLoad(); // in case source has been set first
+    emit previewSourceChanged();
+}
+
+QmlPhotoSphere::Status QmlPhotoSphere::status() const
+{
+    return m_status;
+}
+
+void QmlPhotoSphere::setStatus(Status status)
+{
+    if (status == m_status)
+        return;
+    m_status = status;
+    emit statusChanged(status);
+}
+
+qreal QmlPhotoSphere::progress() const
+{
+    return m_progress;
+}
+
+void QmlPhotoSphere::setProgress(qreal progress)
+{
+    if (progress == m_progress)
+        return;
+    m_progress = progress;
+    emit progressChanged(progress);
+}
+
+void QmlPhotoSphere::setTextureMemoryBudget(qint64 bytes)
+{
+    PhotoSphereTextureCache::setMemoryBudget(bytes);
+}
+
+qint64 QmlPhotoSphere::textureMemoryBudget()
+{
+    return PhotoSphereTextureCache::memoryBudget();
+}
+
+qint64 QmlPhotoSphere::textureMemoryUsage()
+{
+    return PhotoSphereTextureCache::memoryUsage();
+}
+
+void QmlPhotoSphere::setNetworkCacheDirectory(const QString &path)
+{
+    PhotoSphereImageCache::setDiskCacheDirectory(path);
+}
+
+QString QmlPhotoSphere::networkCacheDirectory()
+{
+    return PhotoSphereImageCache::diskCacheDirectory();
+}
+
+void QmlPhotoSphere::setNetworkCacheSize(qint64 bytes)
+{
+    PhotoSphereImageCache::setDiskCacheSize(bytes);
+}
+
+qint64 QmlPhotoSphere::networkCacheSize()
+{
+    return PhotoSphereImageCache::diskCacheSize();
 }
 
 int QmlPhotoSphere::maximumTextureSize() const
@@ -974,11 +2617,159 @@ int QmlPhotoSphere::maximumTextureSize() const
     return qMin(m_maximumTextureSize, int(m_glMaxTexSize));
 }
 
+/// Like maximumTextureSize(), but not affected by the GL limit until that is known
+int QmlPhotoSphere::effectiveMaximumTextureSize() const
+{
+    const int glMaxTexSize = m_glMaxTexSize.load();
+    return (glMaxTexSize > 0) ? qMin(m_maximumTextureSize, glMaxTexSize) : m_maximumTextureSize;
+}
+
+PhotoSphereStats *QmlPhotoSphere::stats()
+{
+    return &m_stats;
+}
+
+/// Called by the renderers once the textures of sourceId are uploaded, and while tiles stream
+void QmlPhotoSphere::setUploadStats(quint64 sourceId, qreal uploadTime, qint64 textureBytes)
+{
+    m_uploadedSourceId = sourceId;
+    m_uploadTime = uploadTime;
+    m_textureBytes = textureBytes;
+    publishStats();
+}
+
+/// Called by the renderers with the averages of the frames of the last interval
+void QmlPhotoSphere::setFrameStats(const PhotoSphereStats::Frames &frames)
+{
+    if (!(frames == m_stats.frames())) {
+        qCDebug(lcPhotoSphereStats) << "Frames: "<< frames.frameRate << " fps, synchronize "
+                                    << frames.synchronizeTime << " ms, render "<< frames.renderTime << " ms";
+    }
+    m_stats.setFrames(frames);
+}
+
+/// Publishes the statistics of the last load, completed with the upload ones once the
+/// renderers report them for the current source
+void QmlPhotoSphere::publishStats()
+{
+    PhotoSphereStats::Load load = m_loadStats;
+    if (m_uploadedSourceId == m_sourceId) {
+        load.uploadTime = m_uploadTime;
+        load.textureBytes = m_textureBytes;
+    }
+    if (!(load == m_stats.load()) && load.textureBytes) {
+        qCDebug(lcPhotoSphereStats) << "Source "<< m_sourceId << ": fetched in "<< load.fetchTime
+                                    << " ms, decoded in "<< load.decodeTime << " ms, scaled in "
+                                    << load.scaleTime << " ms, converted in "<< load.conversionTime
+                                    << " ms, uploaded in "<< load.uploadTime << " ms, "
+                                    << load.textureBytes << " texture bytes";
+    }
+    m_stats.setLoad(load);
+}
+
 void QmlPhotoSphere::signalUpdatedMaxSize()
 {
+    redecode();
     emit maximumTextureSizeChanged();
 }
 
+/// Called when the view changes, to render at interactiveRenderScale until it stops
+void QmlPhotoSphere::noteInteraction()
+{
+    if (m_interactiveRenderScale >= 1.0)
+        return;
+    m_interacting = true;
+    m_interactionTimer.start(m_interactionTimeout);
+}
+
+qreal QmlPhotoSphere::interactiveRenderScale() const
+{
+    return m_interactiveRenderScale;
+}
+
+void QmlPhotoSphere::setInteractiveRenderScale(qreal scale)
+{
+    scale = qBound(qreal(0.1), scale, qreal(1.0));
+    if (scale == m_interactiveRenderScale)
+        return;
+    m_interactiveRenderScale = scale;
+    if (m_interacting)
+        updateSphere();
+    emit interactiveRenderScaleChanged(scale);
+}
+
+int QmlPhotoSphere::interactionTimeout() const
+{
+    return m_interactionTimeout;
+}
+
+void QmlPhotoSphere::setInteractionTimeout(int msecs)
+{
+    msecs = qMax(0, msecs);
+    if (msecs == m_interactionTimeout)
+        return;
+    m_interactionTimeout = msecs;
+    emit interactionTimeoutChanged(msecs);
+}
+
+QmlPhotoSphere::CubeMapConversion QmlPhotoSphere::cubeMapConversion() const
+{
+    return m_cubeMapConversion;
+}
+
+void QmlPhotoSphere::setCubeMapConversion(CubeMapConversion conversion)
+{
+    if (conversion == m_cubeMapConversion)
+        return;
+    m_cubeMapConversion = conversion;
+    if (!m_imageUrl.isEmpty()) // displayed as is, or converted, until the new one is ready
+        startLoad((conversion == NoConversion) ? RendererType::SphereRenderer : RendererType::CubeRenderer,
+                  {QUrl(m_imageUrl)});
+    emit cubeMapConversionChanged(conversion);
+}
+
+QmlPhotoSphere::StereoMode QmlPhotoSphere::stereoMode() const
+{
+    return m_stereoMode;
+}
+
+void QmlPhotoSphere::setStereoMode(StereoMode mode)
+{
+    if (mode == m_stereoMode)
+        return;
+    m_stereoMode = mode;
+    updateSphere();
+    emit stereoModeChanged(mode);
+}
+
+bool QmlPhotoSphere::stereoSource() const
+{
+    return m_stereoSource;
+}
+
+void QmlPhotoSphere::setStereoSource(bool enabled)
+{
+    if (enabled == m_stereoSource)
+        return;
+    m_stereoSource = enabled;
+    updateSphere();
+    emit stereoSourceChanged(enabled);
+}
+
+bool QmlPhotoSphere::rayCasting() const
+{
+    return m_rayCasting;
+}
+
+void QmlPhotoSphere::setRayCasting(bool enabled)
+{
+    if (enabled == m_rayCasting)
+        return;
+    m_rayCasting = enabled;
+    updateSphere();
+    emit rayCastingChanged(enabled);
+}
+
 void QmlPhotoSphere::setMaximumTextureSize(int maxTexSize)
 {
     if (maxTexSize == m_maximumTextureSize)
@@ -986,6 +2777,7 @@ void QmlPhotoSphere::setMaximumTextureSize(int maxTexSize)
 
     int oldSz = maximumTextureSize();
     m_maximumTextureSize = maxTexSize;
+    redecode();
     int newSz = maximumTextureSize();
     if (oldSz == newSz)
         return;
@@ -995,21 +2787,98 @@ void QmlPhotoSphere::setMaximumTextureSize(int maxTexSize)
 
 QSGNode *QmlPhotoSphere::updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data)
 {
-    if (oldNode && m_recreateRenderer) {
+    if (!isOpenGLBackend()) {
+        static QAtomicInt warned;
+        if (warned.testAndSetRelaxed(0, 1))
+            qWarning() << "PhotoSphere requires the OpenGL scene graph backend, nothing is drawn";
+        if (oldNode) {
+            delete oldNode;
+            releaseResources(); // nullifies d->node
+        }
+        return nullptr;
+    }
+
+    const bool direct = canRenderDirectly();
+    if (oldNode && direct != m_renderingDirectly) {
         delete oldNode;
         oldNode = nullptr;
         releaseResources(); // nullifies d->node
-        m_recreateRenderer = false;
     }
-    return QQuickFramebufferObject::updatePaintNode(oldNode, data);
+    m_renderingDirectly = direct;
+    if (!direct)
+        return QQuickFramebufferObject::updatePaintNode(oldNode, data);
+
+    PhotoSphereRenderNode *node = static_cast<PhotoSphereRenderNode *>(oldNode);
+    if (!node)
+        node = new PhotoSphereRenderNode;
+    node->synchronize(this);
+    node->markDirty(QSGNode::DirtyMaterial);
+    return node;
 }
 
-QQuickFramebufferObject::Renderer *QmlPhotoSphere::createRenderer() const
+/// True if the scene graph of the window renders with OpenGL, the only API the renderers
+/// support. Other backends, like the software one, are selected with QQuickWindow::setSceneGraphBackend.
+/// This is where renderers for other APIs would be selected.
+bool QmlPhotoSphere::isOpenGLBackend() const
+{
+    const QSGRendererInterface *rif = window() ? window()->rendererInterface() : nullptr;
+    return rif && rif->graphicsApi() == QSGRendererInterface::OpenGL;
+}
+
+/// True if directRendering is enabled, and nothing detectable requires rendering through an FBO:
+/// a layer or a clip on the item or an ancestor, or a rotation.
+/// ShaderEffectSource items capturing an ancestor can't be found from here, see directRendering.
+bool QmlPhotoSphere::canRenderDirectly() const
 {
-    if (m_rendererType == RendererType::CubeRenderer)
-        return new PhotoSphereRendererCube;
+    if (!m_directRendering)
+        return false;
+    for (const QQuickItem *item = this; item; item = item->parentItem()) {
+        if (item->clip())
+            return false;
+        const QObject *layer = item->property("layer").value<QObject *>();
+        if (layer && layer->property("enabled").toBool())
+            return false;
+    }
+    const QPointF topLeft = mapToScene(QPointF(0, 0));
+    const QPointF topRight = mapToScene(QPointF(width(), 0));
+    const QPointF bottomLeft = mapToScene(QPointF(0, height()));
+    return qFuzzyCompare(topLeft.y(), topRight.y()) && qFuzzyCompare(topLeft.x(), bottomLeft.x());
+}
+
+bool QmlPhotoSphere::lowMemoryMode() const
+{
+    return m_lowMemoryMode;
+}
+
+void QmlPhotoSphere::setLowMemoryMode(bool enabled)
+{
+    if (enabled == m_lowMemoryMode)
+        return;
+    m_lowMemoryMode = enabled;
+    if (enabled)
+        watchResidency();
     else
-        return new PhotoSphereRenderer;
+        restoreSource();
+    emit lowMemoryModeChanged(enabled);
+}
+
+bool QmlPhotoSphere::directRendering() const
+{
+    return m_directRendering;
+}
+
+void QmlPhotoSphere::setDirectRendering(bool enabled)
+{
+    if (enabled == m_directRendering)
+        return;
+    m_directRendering = enabled;
+    updateSphere();
+    emit directRenderingChanged(enabled);
+}
+
+QQuickFramebufferObject::Renderer *QmlPhotoSphere::createRenderer() const
+{
+    return new PhotoSphereFboRenderer;
 }
 
 void QmlPhotoSphere::updateSphere()
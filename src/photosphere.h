@@ -19,11 +19,26 @@
 #ifndef PHOTOSPHERE_H
 #define PHOTOSPHERE_H
 
+#include "photospherektx.h"
+#include "photospherestats.h"
 #include <QQuickItem>
 #include <QImage>
 #include <QVariantMap>
 #include <QAtomicInt>
+#include <QAtomicInteger>
+#include <QScopedPointer>
+#include <QSharedPointer>
+#include <QVector>
+#include <QUrl>
 #include <QQuickFramebufferObject>
+#include <QTimer>
+#include <QVariantAnimation>
+#include <QQuaternion>
+#include <QMutex>
+
+class PhotoSphereImage;
+struct PhotoSphereLoad;
+struct PhotoSphereTiles;
 
 enum CubeFace {
     PX = 0,
@@ -37,7 +52,8 @@ enum CubeFace {
 
 enum RendererType {
     CubeRenderer = 0,
-    SphereRenderer
+    SphereRenderer,
+    TiledRenderer
 };
 
 class QmlPhotoSphere : public QQuickFramebufferObject
@@ -52,10 +68,43 @@ class QmlPhotoSphere : public QQuickFramebufferObject
     Q_PROPERTY(qreal elevation READ elevation WRITE setElevation NOTIFY elevationChanged)
     Q_PROPERTY(qreal fieldOfView READ fieldOfView WRITE setFieldOfView NOTIFY fieldOfViewChanged)
     Q_PROPERTY(int maximumTextureSize READ maximumTextureSize WRITE setMaximumTextureSize NOTIFY maximumTextureSizeChanged)
+    Q_PROPERTY(bool rayCasting READ rayCasting WRITE setRayCasting NOTIFY rayCastingChanged)
+    Q_PROPERTY(bool directRendering READ directRendering WRITE setDirectRendering NOTIFY directRenderingChanged)
+    Q_PROPERTY(bool lowMemoryMode READ lowMemoryMode WRITE setLowMemoryMode NOTIFY lowMemoryModeChanged)
+    Q_PROPERTY(qreal interactiveRenderScale READ interactiveRenderScale WRITE setInteractiveRenderScale NOTIFY interactiveRenderScaleChanged)
+    Q_PROPERTY(int interactionTimeout READ interactionTimeout WRITE setInteractionTimeout NOTIFY interactionTimeoutChanged)
+    Q_PROPERTY(CubeMapConversion cubeMapConversion READ cubeMapConversion WRITE setCubeMapConversion NOTIFY cubeMapConversionChanged)
+    Q_PROPERTY(StereoMode stereoMode READ stereoMode WRITE setStereoMode NOTIFY stereoModeChanged)
+    Q_PROPERTY(bool stereoSource READ stereoSource WRITE setStereoSource NOTIFY stereoSourceChanged)
     Q_PROPERTY(QVariant source READ source WRITE setSource NOTIFY sourceChanged)
-
+    Q_PROPERTY(QString previewSource READ previewSource WRITE setPreviewSource NOTIFY previewSourceChanged)
+    Q_PROPERTY(Status status READ status NOTIFY statusChanged)
+    Q_PROPERTY(qreal progress READ progress NOTIFY progressChanged)
+    Q_PROPERTY(PhotoSphereStats *stats READ stats CONSTANT)
 
 public:
+    enum Status {
+        Null,
+        Ready,
+        Loading,
+        Error
+    };
+    Q_ENUM(Status)
+
+    enum CubeMapConversion {
+        NoConversion,
+        BilinearConversion,
+        BicubicConversion
+    };
+    Q_ENUM(CubeMapConversion)
+
+    enum StereoMode {
+        NoStereo,
+        SideBySide,
+        TopBottom
+    };
+    Q_ENUM(StereoMode)
+
     QmlPhotoSphere(QQuickItem *parent = nullptr);
     ~QmlPhotoSphere();
 
@@ -98,6 +147,34 @@ public:
     qreal fieldOfView() const;
     void setFieldOfView(qreal fov);
 
+/*!
+    \qmlmethod void PhotoSphere::setView(real azimuth, real elevation, real fieldOfView, int duration)
+
+    Sets \l azimuth, \l elevation and \l fieldOfView at once, updating the
+    view a single time, rather than once per property. Values are wrapped,
+    clamped or ignored like when setting the properties.
+    If \a duration is larger than 0, the view is animated to the new values
+    over \a duration milliseconds, along the shortest azimuth path, instead.
+    The animation stops when setView() is called again, or when any of the
+    three properties is set.
+ */
+    Q_INVOKABLE void setView(qreal azimuth, qreal elevation, qreal fieldOfView, int duration = 0);
+
+/*!
+    \fn void QmlPhotoSphere::setSensorOrientation(const QQuaternion &orientation)
+
+    Sets the orientation of the viewer, such as the one of a head tracker or
+    of the device, relative to the direction given by \l azimuth and
+    \l elevation, in the coordinates of the view: x to the right, y up and
+    z towards the viewer.
+    Meant to be fed directly by sensors, this is thread-safe, and neither the
+    properties nor QML bindings are updated. Only the latest orientation is
+    used, when the next frame is prepared, so it can be called at any rate.
+    The default is the identity, meaning no additional rotation.
+ */
+    void setSensorOrientation(const QQuaternion &orientation);
+    QQuaternion sensorOrientation() const;
+
 /*!
     \qmlproperty variant PhotoSphere::source
 
@@ -119,10 +196,69 @@ public:
         "NegativeZ" : "scheme://path/to/negative_Z.ext, // back
     }
     \endcode
+
+    It can also be a multi-resolution tiled cube map, where each face is
+    available at several levels of resolution, each split in square tiles.
+    In this case only the tiles needed for the current view are loaded, at
+    the level matching the current \l fieldOfView and item size, and the
+    first level is used as a fallback while they are loading.
+    \c tileUrl is a template where \c {f} is replaced with the face name,
+    \c {z} with the 0-based level index, \c {l} with the 1-based level index,
+    and \c {x} and \c {y} with the 0-based column and row of the tile.
+    \c levels lists the size of the faces at each level, in increasing order.
+    \c faces optionally overrides the face names, which default to the ones
+    used by Marzipano (f, b, l, r, u, d). Tiles are oriented as the faces of
+    a cube map source.
+
+    \code
+    source: {
+        "tileUrl" : "scheme://path/to/tiles/{z}/{f}/{y}/{x}.jpg",
+        "tileSize" : 512,
+        "levels" : [ 512, 1024, 2048, 4096, 8192 ],
+        "faces" : { "PositiveZ" : "front" } // optional
+    }
+    \endcode
+
+    Images can also be KTX or KTX2 files holding GPU compressed data (ETC1,
+    ETC2, BC1-3, BC7 or ASTC), with their mip maps, which are uploaded as they
+    are, without decoding. The format has to be supported by the GPU.
+    If a cube map uses compressed faces, all the faces have to be compressed
+    in the same format, and to be square and of the same size. Compressed
+    images are not supported for tiled sources.
+
+    Sources are fetched and validated asynchronously. The previously loaded
+    panorama keeps being displayed until the new one is ready, or if the new
+    one fails to load. See \l status and \l progress.
  */
     QVariant source() const;
     void setSource(const QVariant &source);
 
+/*!
+    \qmlmethod void PhotoSphere::prefetch(variant source)
+
+    Starts loading \a source in the background, with a lower priority than
+    the sources being displayed, in any of the formats accepted by \l source.
+    Once it is assigned to \l source, of this or any other PhotoSphere, it is
+    displayed without waiting for it to be fetched and decoded again.
+    For tiled sources, only the first level is prefetched.
+    The 8 most recently prefetched sources are kept.
+ */
+    Q_INVOKABLE void prefetch(const QVariant &source);
+
+/*!
+    \qmlproperty url PhotoSphere::previewSource
+
+    This property holds the url of an equirectangular image to be displayed
+    while \l source is loading, typically a low resolution version of it.
+    A preview is much faster to fetch and decode than a full resolution
+    panorama, and is replaced by it as soon as it is ready. The preview
+    is used for every \l source set afterwards, if any is loading.
+    It can be used with any kind of \l source.
+    By default no preview is used.
+ */
+    QString previewSource() const;
+    void setPreviewSource(const QString &url);
+
 /*!
     \qmlproperty int PhotoSphere::maximumTextureSize
 
@@ -135,42 +271,339 @@ public:
     int maximumTextureSize() const;
     void setMaximumTextureSize(int maxTexSize);
 
+/*!
+    \qmlproperty bool PhotoSphere::rayCasting
+
+    This property holds whether equirectangular sources are rendered by
+    computing, for each pixel, the direction it is looking at and the
+    corresponding point of the image, instead of texturing a tessellated sphere.
+    This samples the image exactly at any \l fieldOfView, without distortion
+    near the poles, at the cost of a few more computations per pixel.
+    On OpenGL ES 2 without GL_OES_standard_derivatives, a thin seam may be
+    visible at the left and right edges of the image.
+    The default value is false. It has no effect on cube maps.
+ */
+    bool rayCasting() const;
+    void setRayCasting(bool enabled);
+
+/*!
+    \qmlproperty bool PhotoSphere::directRendering
+
+    This property holds whether the panorama is drawn directly into the
+    window, as part of the scene graph rendering, instead of into an offscreen
+    framebuffer that is then drawn into the window. This saves a full screen
+    pass and the memory of the framebuffer, which matters on GPUs limited by
+    fill rate.
+    Direct rendering is an opt-in optimization, with limits:
+    \list
+    \li The offscreen framebuffer is still used when the item, or any of its
+        ancestors, has \c layer.enabled or \c clip set, or when the item is
+        rotated.
+    \li A ShaderEffectSource whose \c sourceItem is the item or one of its
+        ancestors is not detected. Such a capture can draw the panorama at the
+        wrong place, or not at all, so leave this property false for items
+        that can be captured.
+    \endlist
+    The default value is false.
+ */
+    bool directRendering() const;
+    void setDirectRendering(bool enabled);
+
+/*!
+    \qmlproperty bool PhotoSphere::lowMemoryMode
+
+    This property holds whether the decoded and the fetched data of the source
+    are released once the source has been uploaded to the GPU, rather than kept
+    for as long as the source is displayed. This saves tens of megabytes per
+    large panorama.
+    If the textures are lost, like when the OpenGL context is, or if
+    \l maximumTextureSize changes, the source is loaded again, from the
+    network disk cache if possible, and \l status goes through Loading.
+    It has no effect on tiled sources.
+    The default value is false.
+ */
+    bool lowMemoryMode() const;
+    void setLowMemoryMode(bool enabled);
+
+/*!
+    \qmlproperty real PhotoSphere::interactiveRenderScale
+
+    This property holds the resolution the panorama is rendered at while the
+    view changes, relative to the full resolution. Rendering fewer pixels
+    keeps the frame rate up while panning or zooming on large displays. Full
+    resolution is restored once \l azimuth, \l elevation and \l fieldOfView
+    have not changed for \l interactionTimeout milliseconds.
+    The default value is 1.0, meaning the resolution is never reduced.
+    Values are clamped to the [0.1, 1.0] range. It has no effect with
+    \l directRendering.
+ */
+    qreal interactiveRenderScale() const;
+    void setInteractiveRenderScale(qreal scale);
+
+/*!
+    \qmlproperty int PhotoSphere::interactionTimeout
+
+    This property holds the time, in milliseconds, the view has to stay still
+    for full resolution rendering to be restored, see \l interactiveRenderScale.
+    The default value is 250.
+ */
+    int interactionTimeout() const;
+    void setInteractionTimeout(int msecs);
+
+/*!
+    \qmlproperty enumeration PhotoSphere::cubeMapConversion
+
+    This property holds whether equirectangular sources are converted into
+    cube maps once decoded, and how they are sampled in the conversion.
+    Equirectangular images wider than \l maximumTextureSize are otherwise
+    scaled down, while each of the six faces of a cube map can be as large as
+    \l maximumTextureSize: a 16K wide panorama is displayed at full resolution
+    with six 4K faces. The conversion takes time and memory at load, and is
+    stored losslessly next to the network disk cache, so that it is done only
+    once per version of the source. It is kept within a budget of its own,
+    separate from the one of the network disk cache and of the same size.
+    KTX sources are not converted.
+
+    \list
+    \li PhotoSphere.NoConversion - equirectangular sources are displayed as such
+    \li PhotoSphere.BilinearConversion - converted, with bilinear sampling
+    \li PhotoSphere.BicubicConversion - converted, with bicubic sampling, sharper but slower
+    \endlist
+
+    The default value is PhotoSphere.NoConversion.
+ */
+    CubeMapConversion cubeMapConversion() const;
+    void setCubeMapConversion(CubeMapConversion conversion);
+
+/*!
+    \qmlproperty enumeration PhotoSphere::stereoMode
+
+    This property holds whether the view is drawn once for each eye, for
+    head mounted displays and other stereoscopic outputs. Both eyes are drawn
+    by the same renderer, in the same pass, with the same textures and
+    geometry, each into half of the item, with \l fieldOfView being the
+    vertical field of view of each eye.
+
+    \list
+    \li PhotoSphere.NoStereo - a single view fills the item
+    \li PhotoSphere.SideBySide - the left eye on the left half, the right eye on the right half
+    \li PhotoSphere.TopBottom - the left eye on the top half, the right eye on the bottom half
+    \endlist
+
+    The default value is PhotoSphere.NoStereo.
+    The eyes differ only with \l stereoSource, panoramas having no parallax
+    otherwise.
+ */
+    StereoMode stereoMode() const;
+    void setStereoMode(StereoMode mode);
+
+/*!
+    \qmlproperty bool PhotoSphere::stereoSource
+
+    This property holds whether equirectangular sources are stereoscopic
+    panoramas, with the view of the left eye in the top half of the image and
+    the one of the right eye in the bottom half, the over-under layout.
+    Without \l stereoMode, the left eye is displayed.
+    It has no effect on cube maps and tiled sources.
+    The default value is false.
+ */
+    bool stereoSource() const;
+    void setStereoSource(bool enabled);
+
+/*!
+    \qmlproperty enumeration PhotoSphere::status
+
+    This property holds the status of the loading of \l source.
+
+    \list
+    \li PhotoSphere.Null - no source has been set
+    \li PhotoSphere.Ready - the source has been loaded
+    \li PhotoSphere.Loading - the source is currently being loaded
+    \li PhotoSphere.Error - an error occurred while loading the source
+    \endlist
+
+    After an error, setting \l source again, to the same value, retries loading it.
+ */
+    Status status() const;
+
+/*!
+    \qmlproperty real PhotoSphere::progress
+
+    This property holds the progress of the loading of \l source, from 0.0
+    (nothing loaded) to 1.0 (finished). For cube maps, the progress is
+    averaged over the six faces.
+ */
+    qreal progress() const;
+
+/*!
+    \qmlproperty PhotoSphereStats PhotoSphere::stats
+
+    This property holds the statistics of the loading of the displayed
+    source, and of the recent frames, to find out where the time goes.
+    The same timings are logged as debug messages of the
+    \c qmlpanorama.stats logging category, disabled by default.
+ */
+    PhotoSphereStats *stats();
+
+/*!
+    \fn void QmlPhotoSphere::setTextureMemoryBudget(qint64 bytes)
+
+    Sets the amount of GPU memory, in bytes, that textures of all PhotoSphere
+    instances are allowed to use, in each set of windows sharing their OpenGL
+    contexts. Windows that don't share contexts, the default unless
+    Qt::AA_ShareOpenGLContexts is set, have a budget each. Textures of
+    panoramas no longer displayed are kept within this budget, so that
+    displaying them again is immediate, and the least recently displayed ones
+    are released first. Textures currently displayed are never released.
+    The default value is 256 MB. Setting it to 0 releases textures as soon as
+    they are no longer displayed.
+ */
+    static void setTextureMemoryBudget(qint64 bytes);
+    static qint64 textureMemoryBudget();
+
+/*!
+    \fn qint64 QmlPhotoSphere::textureMemoryUsage()
+
+    Returns the amount of GPU memory, in bytes, used by the textures of all
+    PhotoSphere instances, including mip maps.
+ */
+    static qint64 textureMemoryUsage();
+
+/*!
+    \fn void QmlPhotoSphere::setNetworkCacheDirectory(const QString &path)
+
+    Sets the directory of the HTTP disk cache shared by all PhotoSphere
+    instances. Fetched sources are stored there, so that showing them again,
+    also across application runs, costs at most a revalidation with the server.
+    The default is a subdirectory of QStandardPaths::CacheLocation. Setting an
+    empty path disables the disk cache.
+ */
+    static void setNetworkCacheDirectory(const QString &path);
+    static QString networkCacheDirectory();
+
+/*!
+    \fn void QmlPhotoSphere::setNetworkCacheSize(qint64 bytes)
+
+    Sets the maximum size, in bytes, of the HTTP disk cache.
+    The default value is 128 MB. Setting it to 0 disables the disk cache.
+ */
+    static void setNetworkCacheSize(qint64 bytes);
+    static qint64 networkCacheSize();
+
 signals:
     void azimuthChanged(qreal azimuth);
     void elevationChanged(qreal elevation);
     void fieldOfViewChanged(qreal fov);
     void sourceChanged();
+    void previewSourceChanged();
     void maximumTextureSizeChanged();
+    void rayCastingChanged(bool enabled);
+    void directRenderingChanged(bool enabled);
+    void lowMemoryModeChanged(bool enabled);
+    void interactiveRenderScaleChanged(qreal scale);
+    void interactionTimeoutChanged(int msecs);
+    void cubeMapConversionChanged(QmlPhotoSphere::CubeMapConversion conversion);
+    void stereoModeChanged(QmlPhotoSphere::StereoMode mode);
+    void stereoSourceChanged(bool enabled);
+    void statusChanged(QmlPhotoSphere::Status status);
+    void progressChanged(qreal progress);
 
 protected:
     QSGNode *updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data) override;
     Renderer *createRenderer() const override;
     void updateSphere();
+    bool isOpenGLBackend() const;
+    bool canRenderDirectly() const;
+    void noteInteraction();
+    void applyView(qreal azimuth, qreal elevation, qreal fov);
+    QQuaternion takeSensorOrientation();
     bool loadFromUrl(const QString &url);
     bool loadFromCubeMap(const QVariantMap &map);
+    bool loadFromTiles(const QVariantMap &map);
+    void startLoad(RendererType type, const QVector<QUrl> &urls);
+    void onLoadProgress(quint64 loadId);
+    void onLoadFinished(quint64 loadId);
+    void applyLoad(const PhotoSphereLoad &load);
+    void startPreviewLoad();
+    void onPreviewFinished(quint64 loadId);
+    void redecode();
+    void watchResidency();
+    void releaseSource();
+    int effectiveMaximumTextureSize() const;
+    void setStatus(Status status);
+    void setProgress(qreal progress);
+    void setUploadStats(quint64 sourceId, qreal uploadTime, qint64 textureBytes);
+    void setFrameStats(const PhotoSphereStats::Frames &frames);
+    void publishStats();
 
 protected slots:
     void signalUpdatedMaxSize();
+    void updateTiles();
+    void restoreSource();
 
 private:
     qreal m_azimuth = 0;
     qreal m_elevation = 0;
     qreal m_fieldOfView = 90;
-    bool m_recreateRenderer = false;
     bool m_nodeDirty = false;
     int m_maximumTextureSize = 65536; // a value large enough to be clamped in any case
+    bool m_rayCasting = false;
+    bool m_directRendering = false;
+    bool m_renderingDirectly = false;
+    bool m_lowMemoryMode = false;
+    qreal m_interactiveRenderScale = 1.0;
+    int m_interactionTimeout = 250;
+    CubeMapConversion m_cubeMapConversion = NoConversion;
+    StereoMode m_stereoMode = NoStereo;
+    bool m_stereoSource = false;
+    bool m_interacting = false;
+    QTimer m_interactionTimer;
+    QVariantAnimation m_viewAnimation; // of azimuth, elevation and fieldOfView, see setView
+    mutable QMutex m_sensorMutex;
+    QQuaternion m_sensorOrientation;
+    QAtomicInt m_sensorUpdatePending = 0; // an update is queued, or the orientation not yet rendered
     QAtomicInt m_glMaxTexSize = -1;
 
-    QByteArray m_image;
+    QImage m_image;
+    PhotoSphereCompressedTexture m_compressedImage;
     QString m_imageUrl;
 
-    QMap<CubeFace, QByteArray> m_cubeMap;
+    QMap<CubeFace, QImage> m_cubeMap;
+    QMap<CubeFace, PhotoSphereCompressedTexture> m_compressedCubeMap;
     QVariantMap m_cubeMapUrls;
+    QVariantMap m_tiledSource;
+    QScopedPointer<PhotoSphereTiles> m_tiles;
+
+    QVector<QSharedPointer<PhotoSphereImage>> m_loadedImages; // keeps the displayed images cached
     RendererType m_rendererType = RendererType::CubeRenderer;
+    quint64 m_sourceId = 0; // the id of the load applied last, identifying the sources
+    bool m_sourceReleased = false; // see lowMemoryMode
+    QVector<QUrl> m_releasedUrls;
+    int m_releasedMaxTexSize = 0;
+    QSharedPointer<QAtomicInteger<quint64>> m_residentSourceId; // set by the renderers
+    QMetaObject::Connection m_frameSwappedConnection;
+
+    Status m_status = Null;
+    qreal m_progress = 0;
+    QScopedPointer<PhotoSphereLoad> m_load;
+    quint64 m_loadId = 0;
+    QString m_previewSource;
+    QScopedPointer<PhotoSphereLoad> m_previewLoad;
+    QList<QVector<QSharedPointer<PhotoSphereImage>>> m_prefetched; // oldest first
+
+    PhotoSphereStats m_stats;
+    PhotoSphereStats::Load m_loadStats; // of the load applied last, see publishStats
+    quint64 m_uploadedSourceId = 0; // the source of m_uploadTime and m_textureBytes
+    qreal m_uploadTime = 0;
+    qint64 m_textureBytes = 0;
 
     friend class PhotoSphereRendererBase;
+    friend class PhotoSphereRendererPool;
     friend class PhotoSphereRenderer;
     friend class PhotoSphereRendererCube;
+    friend class PhotoSphereRendererTiled;
+    friend class PhotoSphereBatchRenderer;
+    friend class tst_Benchmarks;
     Q_DISABLE_COPY(QmlPhotoSphere)
 };
 
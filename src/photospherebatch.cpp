@@ -0,0 +1,227 @@
+/****************************************************************************
+**
+** Copyright (C) 2023- Paolo Angelelli <paolo.angelelli@gmail.com>
+**
+** Commercial License Usage
+** Licensees holding a valid commercial QmlPanorama license may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement with the copyright holder. For licensing terms
+** and conditions and further information contact the copyright holder.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3. The licenses are as published by
+** the Free Software Foundation at https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "photospherebatch.h"
+#include "photosphere.h"
+#include "photospheretiles.h"
+#include "photosphereutils_p.h"
+#include <QQuickRenderControl>
+#include <QQuickWindow>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions>
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QImageWriter>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QDebug>
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+namespace {
+constexpr int maxPendingWrites = 8; // bounds the memory held by images waiting to be encoded
+constexpr int maxUploadFrames = 1000; // safety net, uploads take a handful of frames per source
+
+/// Identifies a source, so that jobs on the same one can be rendered together
+QString sourceKey(const QVariant &source)
+{
+    if (source.canConvert<QVariantMap>() && source.type() != QVariant::String)
+        return QString::fromUtf8(QJsonDocument(QJsonObject::fromVariantMap(source.toMap()))
+                                 .toJson(QJsonDocument::Compact));
+    return source.toString();
+}
+}
+
+PhotoSphereBatchRenderer::PhotoSphereBatchRenderer(QObject *parent)
+    : QObject(parent), m_pendingWrites(maxPendingWrites)
+{
+}
+
+PhotoSphereBatchRenderer::~PhotoSphereBatchRenderer()
+{
+    m_encoders.waitForDone();
+    if (!m_initialized)
+        return;
+    // The scene graph releases its GL resources, those of the renderers included, on invalidate
+    m_context.makeCurrent(&m_surface);
+    m_renderControl->invalidate();
+    m_window.reset();
+    delete m_renderControl;
+    m_fbo.reset();
+    m_context.doneCurrent();
+}
+
+void PhotoSphereBatchRenderer::setQuality(int quality)
+{
+    m_quality = quality;
+}
+
+int PhotoSphereBatchRenderer::quality() const
+{
+    return m_quality;
+}
+
+bool PhotoSphereBatchRenderer::initialize()
+{
+    if (m_initialized)
+        return true;
+
+    m_context.setFormat(QSurfaceFormat::defaultFormat());
+    if (!m_context.create()) {
+        qWarning() << "Failed creating an OpenGL context for batch rendering";
+        return false;
+    }
+    m_surface.setFormat(m_context.format());
+    m_surface.create();
+    if (!m_context.makeCurrent(&m_surface)) {
+        qWarning() << "Failed making the batch rendering context current";
+        return false;
+    }
+
+    m_renderControl = new QQuickRenderControl;
+    m_window.reset(new QQuickWindow(m_renderControl));
+    m_window->setColor(Qt::black);
+    m_item = new QmlPhotoSphere(m_window->contentItem());
+    // Straight into the target, saving the pass through the item framebuffer
+    m_item->setDirectRendering(true);
+    m_renderControl->initialize(&m_context);
+    m_initialized = true;
+
+    // A first frame, for the renderers to report the texture size limits that sources are
+    // decoded for, not to decode them twice.
+    renderFrame(QSize(64, 64));
+    QCoreApplication::processEvents();
+    return true;
+}
+
+bool PhotoSphereBatchRenderer::loadSource(const QVariant &source)
+{
+    if (source.canConvert<QVariantMap>() && source.type() != QVariant::String
+            && PhotoSphereTileLayout::isTiledSource(source.toMap())) {
+        qWarning() << "Tiled sources are not supported in batch rendering: "<< source;
+        return false;
+    }
+
+    m_item->setSource(source);
+    if (m_item->status() == QmlPhotoSphere::Loading) {
+        QEventLoop loop;
+        connect(m_item, &QmlPhotoSphere::statusChanged, &loop, [&loop](QmlPhotoSphere::Status status) {
+            if (status != QmlPhotoSphere::Loading)
+                loop.quit();
+        });
+        loop.exec();
+    }
+    if (m_item->status() != QmlPhotoSphere::Ready || sourceKey(m_item->source()) != sourceKey(source)) {
+        qWarning() << "Failed loading batch source "<< source;
+        return false;
+    }
+    return true;
+}
+
+void PhotoSphereBatchRenderer::renderFrame(const QSize &size)
+{
+    m_context.makeCurrent(&m_surface);
+    if (!m_fbo || m_fbo->size() != size) {
+        m_fbo.reset(new QOpenGLFramebufferObject(size, QOpenGLFramebufferObject::CombinedDepthStencil));
+        m_window->setRenderTarget(m_fbo.data());
+        m_window->setGeometry(0, 0, size.width(), size.height());
+        m_item->setSize(size);
+    }
+    m_renderControl->polishItems();
+    m_renderControl->sync();
+    m_renderControl->render();
+    m_context.functions()->glFlush();
+}
+
+QImage PhotoSphereBatchRenderer::renderView(const Job &job)
+{
+    if (!initialize() || job.size.isEmpty())
+        return QImage();
+
+    m_item->setView(job.azimuth, job.elevation, job.fieldOfView);
+    // Textures are uploaded in bands over several frames. Once resident, one more frame
+    // draws them, rather than what was there before.
+    int frames = 0;
+    do {
+        renderFrame(job.size);
+        QCoreApplication::processEvents();
+    } while (m_item->m_residentSourceId->loadAcquire() != m_item->m_sourceId && ++frames < maxUploadFrames);
+    if (frames == maxUploadFrames) {
+        qWarning() << "Timed out uploading the textures of "<< m_item->source();
+        return QImage();
+    }
+    renderFrame(job.size);
+    m_context.makeCurrent(&m_surface);
+    return m_fbo->toImage();
+}
+
+void PhotoSphereBatchRenderer::write(const QImage &image, const QString &fileName)
+{
+    m_pendingWrites.acquire();
+    const int quality = m_quality;
+    m_encoders.start(new PhotoSphereJob([this, image, fileName, quality]() {
+        QImageWriter writer(fileName);
+        writer.setQuality(quality);
+        if (!writer.write(image)) {
+            qWarning() << "Failed writing "<< fileName << ": "<< writer.errorString();
+            m_failedWrites.fetchAndAddRelaxed(1);
+        }
+        m_pendingWrites.release();
+    }));
+}
+
+int PhotoSphereBatchRenderer::render(const QVector<Job> &jobs)
+{
+    if (!initialize())
+        return jobs.size();
+
+    // Grouped by source, then by size, in the order sources first appear
+    QStringList order;
+    QMap<QString, QVector<const Job *>> bySource;
+    for (const Job &job : jobs) {
+        const QString key = sourceKey(job.source);
+        if (!bySource.contains(key))
+            order.append(key);
+        bySource[key].append(&job);
+    }
+
+    int failed = 0;
+    m_failedWrites = 0;
+    for (const QString &key : qAsConst(order)) {
+        QVector<const Job *> group = bySource.value(key);
+        if (!loadSource(group.first()->source)) {
+            failed += group.size();
+            continue;
+        }
+        std::stable_sort(group.begin(), group.end(), [](const Job *a, const Job *b) {
+            return qMakePair(a->size.width(), a->size.height()) < qMakePair(b->size.width(), b->size.height());
+        });
+        for (const Job *job : qAsConst(group)) {
+            const QImage image = renderView(*job);
+            if (image.isNull()) {
+                ++failed;
+                continue;
+            }
+            write(image, job->fileName);
+        }
+    }
+    m_encoders.waitForDone();
+    return failed + m_failedWrites.load();
+}
@@ -0,0 +1,101 @@
+/****************************************************************************
+**
+** Copyright (C) 2023- Paolo Angelelli <paolo.angelelli@gmail.com>
+**
+** Commercial License Usage
+** Licensees holding a valid commercial QmlPanorama license may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement with the copyright holder. For licensing terms
+** and conditions and further information contact the copyright holder.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3. The licenses are as published by
+** the Free Software Foundation at https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef PHOTOSPHEREBATCH_H
+#define PHOTOSPHEREBATCH_H
+
+#include <QObject>
+#include <QVariant>
+#include <QVector>
+#include <QSize>
+#include <QString>
+#include <QImage>
+#include <QThreadPool>
+#include <QSemaphore>
+#include <QAtomicInt>
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QScopedPointer>
+
+class QQuickRenderControl;
+class QQuickWindow;
+class QOpenGLFramebufferObject;
+class QmlPhotoSphere;
+
+/// PhotoSphereBatchRenderer renders views of panoramas offscreen, without a window, and writes
+/// them to image files, e.g. to generate thumbnails on servers.
+/// Views are rendered by a QmlPhotoSphere driven through QQuickRenderControl, so that they
+/// look exactly as in the item, sharing its loading, caches and renderers.
+/// Jobs are grouped by source, so that each source is fetched, decoded and uploaded once,
+/// and images are encoded in a thread pool while the next views are rendered.
+/// Equirectangular and cube map sources are supported, tiled ones are not.
+/// GUI thread only. Requires a QGuiApplication, possibly on a headless platform plugin,
+/// like offscreen or eglfs.
+class PhotoSphereBatchRenderer : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Job
+    {
+        QVariant source; // in the formats accepted by PhotoSphere::source
+        qreal azimuth = 0;
+        qreal elevation = 0;
+        qreal fieldOfView = 90;
+        QSize size = QSize(640, 480);
+        QString fileName; // the image format is deduced from the suffix
+    };
+
+    explicit PhotoSphereBatchRenderer(QObject *parent = nullptr);
+    ~PhotoSphereBatchRenderer() override;
+
+    /// The quality of the written images, see QImageWriter::setQuality. Defaults to -1,
+    /// the default of each format.
+    void setQuality(int quality);
+    int quality() const;
+
+    /// Renders all jobs, blocking until all images are written. Events are processed
+    /// while sources load. Returns the number of jobs that failed, reported with qWarning.
+    int render(const QVector<Job> &jobs);
+
+    /// Renders a single view of the current source, once its textures are uploaded.
+    /// Returns a null image on failure.
+    QImage renderView(const Job &job);
+
+private:
+    bool initialize();
+    bool loadSource(const QVariant &source);
+    void renderFrame(const QSize &size);
+    void write(const QImage &image, const QString &fileName);
+
+    QOpenGLContext m_context;
+    QOffscreenSurface m_surface;
+    QQuickRenderControl *m_renderControl = nullptr;
+    QScopedPointer<QQuickWindow> m_window;
+    QmlPhotoSphere *m_item = nullptr; // owned by m_window
+    QScopedPointer<QOpenGLFramebufferObject> m_fbo;
+    bool m_initialized = false;
+    int m_quality = -1;
+    QThreadPool m_encoders;
+    QSemaphore m_pendingWrites; // limits the images waiting to be encoded
+    QAtomicInt m_failedWrites;
+
+    Q_DISABLE_COPY(PhotoSphereBatchRenderer)
+};
+
+#endif // PHOTOSPHEREBATCH_H
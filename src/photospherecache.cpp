@@ -0,0 +1,700 @@
+/****************************************************************************
+**
+** Copyright (C) 2023- Paolo Angelelli <paolo.angelelli@gmail.com>
+**
+** Commercial License Usage
+** Licensees holding a valid commercial QmlPanorama license may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement with the copyright holder. For licensing terms
+** and conditions and further information contact the copyright holder.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3. The licenses are as published by
+** the Free Software Foundation at https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "photospherecache.h"
+#include "photosphereconvert.h"
+#include "photosphereutils_p.h"
+#include <QtGui/qopenglcontext.h>
+#include <QtGui/QOpenGLTexture>
+#include <QNetworkAccessManager>
+#include <QNetworkDiskCache>
+#include <QNetworkReply>
+#include <QStandardPaths>
+#include <QCoreApplication>
+#include <QThreadPool>
+#include <QImageReader>
+#include <QBuffer>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QAtomicInteger>
+#include <QSet>
+#include <QPointer>
+#include <QDebug>
+#include <limits>
+#include <utility>
+
+Q_LOGGING_CATEGORY(lcPhotoSphereStats, "qmlpanorama.stats", QtWarningMsg)
+
+namespace {
+/// Decodes data into an image no wider than maxSize, ready to be uploaded to a texture.
+/// Returns a null image on failure.
+/// Oversized images are scaled by the decoder where supported (e.g., DCT-domain scaling
+/// for JPEG), so that the full resolution bitmap is never allocated.
+/// The time spent is added to timings, if not null.
+QImage decodeImage(const QByteArray &data, int maxSize, PhotoSphereImage::Timings *timings = nullptr)
+{
+    QElapsedTimer timer;
+    timer.start();
+    QBuffer buffer;
+    buffer.setData(data);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader(&buffer);
+
+    const QSize size = reader.size();
+    if (size.isValid() && size.width() > maxSize
+            && reader.supportsOption(QImageIOHandler::ScaledSize)) {
+        const int height = qMax(1, qRound(size.height() * (qreal(maxSize) / size.width())));
+        reader.setScaledSize(QSize(maxSize, height));
+    }
+
+    QImage image = reader.read();
+    if (timings)
+        timings->decode += timer.nsecsElapsed() / 1e6;
+    if (image.isNull() || !image.width() || !image.height())
+        return QImage();
+    timer.restart();
+    if (image.width() > maxSize) // format not supporting scaled reads
+        image = image.scaledToWidth(maxSize, Qt::SmoothTransformation);
+    // The format QOpenGLTexture::setData() converts to, so that the upload doesn't copy it again.
+    // Converting an rvalue allows Qt to do it in place.
+    image = std::move(image).convertToFormat(QImage::Format_RGBA8888);
+    if (timings)
+        timings->scale += timer.nsecsElapsed() / 1e6;
+    return image;
+}
+
+struct DiskCacheConfig
+{
+    DiskCacheConfig()
+    {
+        const QString location = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+        if (!location.isEmpty())
+            directory = location + QLatin1String("/qmlpanorama");
+    }
+
+    QString directory;
+    qint64 size = 128 * 1024 * 1024;
+};
+
+DiskCacheConfig &diskCacheConfig()
+{
+    static DiskCacheConfig config;
+    return config;
+}
+
+/// Sets on nam a disk cache as configured, replacing (and deleting) the previous one
+void applyDiskCache(QNetworkAccessManager *nam)
+{
+    const DiskCacheConfig &config = diskCacheConfig();
+    if (config.directory.isEmpty() || config.size <= 0) {
+        nam->setCache(nullptr);
+        return;
+    }
+    QNetworkDiskCache *cache = new QNetworkDiskCache;
+    cache->setCacheDirectory(config.directory);
+    cache->setMaximumCacheSize(config.size);
+    nam->setCache(cache);
+}
+
+struct DecodedImage
+{
+    QImage image;
+    PhotoSphereCompressedTexture compressed;
+    QMap<CubeFace, QImage> faces;
+    PhotoSphereImage::Timings timings;
+};
+
+using Decoder = std::function<DecodedImage(const QByteArray &)>;
+
+/// Decodes data, which is either a KTX container, read as is, or any image format
+/// supported by QImageReader, decoded with decodeImage()
+DecodedImage decodeData(const QByteArray &data, int maxSize)
+{
+    DecodedImage decoded;
+    if (PhotoSphereCompressedTexture::isKtx(data)) {
+        QElapsedTimer timer;
+        timer.start();
+        decoded.compressed = PhotoSphereCompressedTexture::fromKtx(data, maxSize);
+        decoded.timings.decode = timer.nsecsElapsed() / 1e6;
+    } else {
+        decoded.image = decodeImage(data, maxSize, &decoded.timings);
+    }
+    return decoded;
+}
+
+/// Decodes data into an equirectangular image, converted into cube faces no larger than maxSize.
+/// The conversion is looked up in, and stored to, directory, keeping it within cacheSize.
+/// It is identified by source, see sourceIdentity(), or by data itself if source is empty.
+/// KTX containers can't be converted, and are read as such.
+DecodedImage decodeToCubeMap(const QByteArray &data, const QByteArray &source, int maxSize,
+                             PhotoSphereCubeConverter::Filter filter, const QString &directory,
+                             qint64 cacheSize)
+{
+    DecodedImage decoded;
+    if (PhotoSphereCompressedTexture::isKtx(data)) {
+        qWarning() << "Compressed textures can't be converted to cube maps, displaying them as they are";
+        decoded.compressed = PhotoSphereCompressedTexture::fromKtx(data, maxSize);
+        return decoded;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    const QByteArray key = PhotoSphereCubeConverter::key(source.isEmpty() ? data : source, maxSize, filter);
+    decoded.faces = PhotoSphereCubeConverter::load(directory, key);
+    if (!decoded.faces.isEmpty()) {
+        decoded.timings.decode = timer.nsecsElapsed() / 1e6;
+        return decoded;
+    }
+
+    // The faces span a quarter of the width each, so up to 4 times maxSize is still useful
+    const int equirectMaxSize = int(qMin<qint64>(4 * qint64(maxSize), std::numeric_limits<int>::max()));
+    const QImage equirect = decodeImage(data, equirectMaxSize, &decoded.timings);
+    if (equirect.isNull())
+        return decoded;
+    timer.restart();
+    decoded.faces = PhotoSphereCubeConverter::convert(
+                equirect, PhotoSphereCubeConverter::faceSize(equirect.width(), maxSize), filter);
+    decoded.timings.conversion = timer.nsecsElapsed() / 1e6;
+    PhotoSphereCubeConverter::store(directory, key, decoded.faces, cacheSize);
+    return decoded;
+}
+
+/// Decodes the image file at path, mapping it in memory, so that the encoded data is
+/// neither copied to the heap nor read through the network stack. Files that can't be
+/// mapped, like compressed resources, are read instead.
+DecodedImage decodeLocalFile(const QString &path, const Decoder &decode)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Failed opening "<< path << ": " << file.errorString();
+        return DecodedImage();
+    }
+    const qint64 size = file.size();
+    uchar *mapped = nullptr;
+    if (size > 0 && size <= std::numeric_limits<int>::max()) // QByteArray limit
+        mapped = file.map(0, size);
+    if (!mapped)
+        return decode(file.readAll());
+
+    // Only valid as long as the mapping, which outlives the decoding
+    const QByteArray data = QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), int(size));
+    return decode(data);
+}
+
+/// Returns the path QFile can open for url, if local, or an empty string
+QString localFilePath(const QUrl &url)
+{
+    if (url.isLocalFile())
+        return url.toLocalFile();
+    if (url.scheme().compare(QLatin1String("qrc"), Qt::CaseInsensitive) == 0)
+        return QLatin1Char(':') + url.path();
+    return QString();
+}
+
+/// The network access manager shared by all PhotoSphere instances, living in the GUI thread.
+/// Being long lived, connections to the same host are kept alive and reused.
+QNetworkAccessManager *networkAccessManager(bool create = true)
+{
+    static QPointer<QNetworkAccessManager> nam;
+    if (!nam && create) {
+        nam = new QNetworkAccessManager(QCoreApplication::instance());
+        applyDiskCache(nam);
+    }
+    return nam;
+}
+
+/// Identifies the version of the image at url, without reading it: local files by path, size
+/// and modification time, fetched ones by url and the validators in the HTTP disk cache.
+/// Returns an empty array if there is no such information, like for replies without ETag
+/// or Last-Modified headers.
+QByteArray sourceIdentity(const QUrl &url, const QString &localFile)
+{
+    if (!localFile.isEmpty()) {
+        const QFileInfo info(localFile);
+        return info.absoluteFilePath().toUtf8() + '\n' + QByteArray::number(info.size()) + '\n'
+                + QByteArray::number(info.lastModified().toMSecsSinceEpoch());
+    }
+    QNetworkAccessManager *nam = networkAccessManager(false);
+    QAbstractNetworkCache *cache = nam ? nam->cache() : nullptr;
+    const QNetworkCacheMetaData metaData = cache ? cache->metaData(url) : QNetworkCacheMetaData();
+    if (!metaData.isValid())
+        return QByteArray();
+    QByteArray etag;
+    for (const QNetworkCacheMetaData::RawHeader &header : metaData.rawHeaders()) {
+        if (header.first.compare("ETag", Qt::CaseInsensitive) == 0)
+            etag = header.second;
+    }
+    if (etag.isEmpty() && !metaData.lastModified().isValid())
+        return QByteArray();
+    return url.toEncoded() + '\n' + etag + '\n'
+            + QByteArray::number(metaData.lastModified().toMSecsSinceEpoch());
+}
+
+struct TextureCacheEntry
+{
+    QSharedPointer<QOpenGLTexture> texture; // owned by the cache
+    QWeakPointer<QOpenGLTexture> handle;    // shared by the renderers using the texture
+    qint64 bytes = 0;
+    quint64 lastUsed = 0;
+};
+
+struct TextureCacheData
+{
+    QMutex mutex;
+    QHash<QOpenGLContextGroup *, QMap<PhotoSphereTextureCache::Key, TextureCacheEntry>> textures;
+    QHash<QOpenGLContextGroup *, qint64> groupBytes; // the budget applies to each group
+    QSet<QOpenGLContext *> contexts; // watched for destruction
+    quint64 clock = 0;
+    QAtomicInteger<qint64> bytesUsed = 0; // by all groups
+    QAtomicInteger<qint64> budget = 256 * 1024 * 1024;
+};
+
+TextureCacheData &textureCacheData()
+{
+    static TextureCacheData data;
+    return data;
+}
+}
+
+/// The decode job of an image while it waits in the thread pool, so that it can be queued
+/// again with a higher priority. Cleared by the job as it starts running, under mutex, so that
+/// job is valid, and owned by the pool, while set.
+struct PhotoSphereQueuedDecode
+{
+    QMutex mutex;
+    QRunnable *job = nullptr;
+};
+
+namespace {
+/// Each normal priority decode is queued with a higher priority than the previous ones,
+/// so that the most recently requested image is decoded first
+int nextNormalPriority()
+{
+    static int normalPriority = 0;
+    return ++normalPriority;
+}
+}
+
+/*
+ *
+ * PhotoSphereImage
+ *
+ */
+
+PhotoSphereImage::PhotoSphereImage(const QUrl &url, int maxTexSize, Priority priority, Conversion conversion)
+    : m_url(url), m_maxTexSize(maxTexSize), m_priority(priority), m_conversion(conversion),
+      m_cancelled(new QAtomicInt(0))
+{
+}
+
+PhotoSphereImage::~PhotoSphereImage()
+{
+    m_cancelled->storeRelease(1);
+    if (m_reply) {
+        m_reply->disconnect(this); // abort() emits finished
+        m_reply->abort();
+    }
+}
+
+void PhotoSphereImage::fetch()
+{
+    QNetworkRequest request;
+    request.setUrl(m_url);
+    // Superseded fetches are aborted, the ones still wanted come first
+    request.setPriority((m_priority == LowPriority) ? QNetworkRequest::LowPriority
+                                                    : QNetworkRequest::HighPriority);
+    // Cube faces and tiles from the same host are multiplexed over a single connection
+    request.setAttribute(QNetworkRequest::Http2AllowedAttribute, true);
+    // The default PreferNetwork uses fresh cached replies, and revalidates stale ones
+    // with If-None-Match / If-Modified-Since, so that a revisit costs a 304 at most
+    request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferNetwork);
+    m_fetchTimer.start();
+    QNetworkReply *reply = networkAccessManager()->get(request);
+    m_reply = reply;
+    connect(reply, &QNetworkReply::finished, reply, &QObject::deleteLater);
+    connect(reply, &QNetworkReply::downloadProgress, this, [this](qint64 received, qint64 total) {
+        m_bytesReceived = received;
+        m_bytesTotal = total;
+        emit progress(received, total);
+    });
+    connect(reply, &QNetworkReply::finished, this, [this, reply]() {
+        if (reply->error() != QNetworkReply::NoError) {
+            qWarning() << "Failed fetching "<< m_url << ": " << reply->errorString();
+            finish(Error);
+            return;
+        }
+        m_data = reply->readAll();
+        m_timings.fetch = m_fetchTimer.nsecsElapsed() / 1e6;
+        qCDebug(lcPhotoSphereStats) << "Fetched "<< m_url << " ("<< m_data.size() << " bytes) in "
+                                    << m_timings.fetch << " ms";
+        decode();
+    });
+}
+
+/// Decodes m_data in the thread pool.
+/// The result is delivered through the application object, so that the QPointer
+/// is only dereferenced in the GUI thread.
+/// Each decode is queued with a higher priority than the previous ones, so that
+/// the most recently requested image is decoded first. Low priority ones come after all
+/// the others, unless raised, see raisePriority(). Decodes of images destroyed before their
+/// turn are skipped.
+/// The disk cache configuration used by conversions, and the identity of the source they are
+/// stored by, are read here, in the GUI thread.
+void PhotoSphereImage::decode()
+{
+    const int priority = (m_priority == LowPriority) ? 0 : nextNormalPriority();
+    QPointer<PhotoSphereImage> self(this);
+    const QByteArray data = m_data;
+    const int maxTexSize = m_maxTexSize;
+    const QString localFile = m_localFile;
+    const QSharedPointer<QAtomicInt> cancelled = m_cancelled;
+    const QSharedPointer<PhotoSphereQueuedDecode> queued(new PhotoSphereQueuedDecode);
+    m_queuedDecode = queued;
+
+    Decoder decoder = [maxTexSize](const QByteArray &data) { return decodeData(data, maxTexSize); };
+    if (m_conversion != NoConversion) {
+        const PhotoSphereCubeConverter::Filter filter = (m_conversion == BicubicCubeMap)
+                ? PhotoSphereCubeConverter::Bicubic : PhotoSphereCubeConverter::Bilinear;
+        const QString directory = PhotoSphereImageCache::diskCacheDirectory();
+        const qint64 cacheSize = PhotoSphereImageCache::diskCacheSize();
+        const QByteArray source = sourceIdentity(m_url, localFile);
+        decoder = [source, maxTexSize, filter, directory, cacheSize](const QByteArray &data) {
+            return decodeToCubeMap(data, source, maxTexSize, filter, directory, cacheSize);
+        };
+    }
+
+    QMutexLocker locker(&queued->mutex);
+    queued->job = new PhotoSphereJob([self, data, localFile, decoder, cancelled, queued]() {
+        {
+            QMutexLocker locker(&queued->mutex);
+            queued->job = nullptr;
+        }
+        if (cancelled->loadAcquire())
+            return;
+        const DecodedImage decoded = localFile.isEmpty() ? decoder(data)
+                                                         : decodeLocalFile(localFile, decoder);
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [self, decoded]() {
+            if (self)
+                self->onDecoded(decoded.image, decoded.compressed, decoded.faces, decoded.timings);
+        }, Qt::QueuedConnection);
+    });
+    QThreadPool::globalInstance()->start(queued->job, priority);
+}
+
+/// Raises a low priority image to normal priority. A fetch in progress keeps its priority,
+/// the decode following it is queued as normal. A decode still waiting in the thread pool
+/// is taken back and queued again, as the most recent one.
+void PhotoSphereImage::raisePriority()
+{
+    if (m_priority == NormalPriority)
+        return;
+    m_priority = NormalPriority;
+    if (!m_queuedDecode)
+        return;
+    QMutexLocker locker(&m_queuedDecode->mutex);
+    QThreadPool *pool = QThreadPool::globalInstance();
+    if (m_queuedDecode->job && pool->tryTake(m_queuedDecode->job))
+        pool->start(m_queuedDecode->job, nextNormalPriority());
+}
+
+void PhotoSphereImage::onDecoded(const QImage &image, const PhotoSphereCompressedTexture &compressed,
+                                 const QMap<CubeFace, QImage> &faces, const Timings &timings)
+{
+    if (image.isNull() && compressed.isNull() && faces.isEmpty()) {
+        qWarning() << "Failed decoding image at "<< m_url;
+        finish(Error);
+        return;
+    }
+    m_image = image;
+    m_compressed = compressed;
+    m_faces = faces;
+    m_timings.decode = timings.decode;
+    m_timings.scale = timings.scale;
+    m_timings.conversion = timings.conversion;
+    qCDebug(lcPhotoSphereStats) << "Decoded "<< m_url << " in "<< timings.decode << " ms, scaled in "
+                                << timings.scale << " ms, converted in "<< timings.conversion << " ms";
+    finish(Ready);
+}
+
+void PhotoSphereImage::finish(Status status)
+{
+    m_status = status;
+    emit finished();
+}
+
+/*
+ *
+ * PhotoSphereImageCache
+ *
+ */
+
+PhotoSphereImageCache *PhotoSphereImageCache::instance()
+{
+    static PhotoSphereImageCache cache;
+    return &cache;
+}
+
+QSharedPointer<PhotoSphereImage> PhotoSphereImageCache::image(const QUrl &url, int maxTexSize,
+                                                             PhotoSphereImage::Priority priority,
+                                                             PhotoSphereImage::Conversion conversion)
+{
+    const auto key = qMakePair(url, qMakePair(maxTexSize, int(conversion)));
+    QSharedPointer<PhotoSphereImage> image = m_images.value(key).toStrongRef();
+    if (image && image->status() != PhotoSphereImage::Error) {
+        if (priority == PhotoSphereImage::NormalPriority)
+            image->raisePriority();
+        return image;
+    }
+
+    prune();
+    // deleteLater, as the last reference may be dropped while handling one of its signals
+    image.reset(new PhotoSphereImage(url, maxTexSize, priority, conversion), &QObject::deleteLater);
+    m_images.insert(key, image);
+
+    const QString localFile = localFilePath(url);
+    const QByteArray data = localFile.isEmpty() ? cachedData(url) : QByteArray();
+    if (!localFile.isEmpty()) {
+        image->m_localFile = localFile;
+        image->decode();
+    } else if (data.isEmpty()) {
+        image->fetch();
+    } else {
+        image->m_data = data;
+        image->decode();
+    }
+    return image;
+}
+
+void PhotoSphereImageCache::setDiskCacheDirectory(const QString &path)
+{
+    if (path == diskCacheConfig().directory)
+        return;
+    diskCacheConfig().directory = path;
+    if (QNetworkAccessManager *nam = networkAccessManager(false))
+        applyDiskCache(nam);
+}
+
+QString PhotoSphereImageCache::diskCacheDirectory()
+{
+    return diskCacheConfig().directory;
+}
+
+void PhotoSphereImageCache::setDiskCacheSize(qint64 bytes)
+{
+    diskCacheConfig().size = qMax<qint64>(0, bytes);
+    QNetworkAccessManager *nam = networkAccessManager(false);
+    if (!nam)
+        return;
+    if (QNetworkDiskCache *cache = qobject_cast<QNetworkDiskCache *>(nam->cache()))
+        cache->setMaximumCacheSize(diskCacheConfig().size);
+    else
+        applyDiskCache(nam);
+}
+
+qint64 PhotoSphereImageCache::diskCacheSize()
+{
+    return diskCacheConfig().size;
+}
+
+QByteArray PhotoSphereImageCache::cachedData(const QUrl &url) const
+{
+    for (const auto &weakImage : m_images) {
+        const QSharedPointer<PhotoSphereImage> image = weakImage.toStrongRef();
+        if (image && image->url() == url && !image->data().isEmpty())
+            return image->data();
+    }
+    return QByteArray();
+}
+
+void PhotoSphereImageCache::prune()
+{
+    for (auto it = m_images.begin(); it != m_images.end();) {
+        if (it.value().isNull())
+            it = m_images.erase(it);
+        else
+            ++it;
+    }
+}
+
+/*
+ *
+ * PhotoSphereTextureCache
+ *
+ */
+
+QSharedPointer<QOpenGLTexture> PhotoSphereTextureCache::texture(const Key &key,
+                                                               const std::function<QOpenGLTexture *()> &create)
+{
+    QOpenGLContext *ctx = QOpenGLContext::currentContext();
+    Q_ASSERT(ctx);
+    QOpenGLContextGroup *group = ctx->shareGroup();
+    TextureCacheData &d = textureCacheData();
+
+    // Handles shared by the renderers don't delete the texture, which is owned by the cache,
+    // but mark it as no longer in use when released.
+    auto textureHandle = [group, &key](TextureCacheEntry &entry) {
+        QSharedPointer<QOpenGLTexture> handle = entry.handle.toStrongRef();
+        if (!handle) {
+            handle = QSharedPointer<QOpenGLTexture>(entry.texture.data(), [group, key](QOpenGLTexture *) {
+                release(group, key);
+            });
+            entry.handle = handle;
+        }
+        return handle;
+    };
+
+    {
+        QMutexLocker locker(&d.mutex);
+        auto &textures = d.textures[group];
+        auto it = textures.find(key);
+        if (it != textures.end()) {
+            it->lastUsed = ++d.clock;
+            return textureHandle(*it);
+        }
+    }
+
+    // Not holding the lock while uploading, not to stall other render threads
+    QSharedPointer<QOpenGLTexture> texture(create());
+    if (!texture)
+        return texture;
+
+    QMutexLocker locker(&d.mutex);
+    auto &textures = d.textures[group];
+    auto it = textures.find(key);
+    if (it != textures.end()) { // created meanwhile by another render thread of the group
+        it->lastUsed = ++d.clock;
+        return textureHandle(*it);
+    }
+
+    if (!d.contexts.contains(ctx)) {
+        d.contexts.insert(ctx);
+        // Quick destroys its contexts while current, so textures can be deleted here
+        QObject::connect(ctx, &QOpenGLContext::aboutToBeDestroyed, [ctx, group]() {
+            {
+                QMutexLocker locker(&textureCacheData().mutex);
+                textureCacheData().contexts.remove(ctx);
+            }
+            if (group->shares().size() <= 1)
+                releaseGroup(group);
+        });
+    }
+
+    TextureCacheEntry entry;
+    entry.texture = texture;
+    entry.bytes = textureBytes(texture.data());
+    entry.lastUsed = ++d.clock;
+    it = textures.insert(key, entry);
+    d.groupBytes[group] += entry.bytes;
+    d.bytesUsed.fetchAndAddOrdered(entry.bytes);
+    QSharedPointer<QOpenGLTexture> handle = textureHandle(*it);
+    evict(group);
+    return handle;
+}
+
+void PhotoSphereTextureCache::release(QOpenGLContextGroup *group, const Key &key)
+{
+    TextureCacheData &d = textureCacheData();
+    QMutexLocker locker(&d.mutex);
+    auto groupIt = d.textures.find(group);
+    if (groupIt == d.textures.end())
+        return;
+    auto it = groupIt->find(key);
+    if (it == groupIt->end())
+        return;
+    it->lastUsed = ++d.clock; // last shown now
+    evict(group);
+}
+
+/// Evicts unused textures of group, least recently used first, until the group is within budget.
+/// Expects the mutex to be locked, and the context of group to be current.
+/// Only the textures of the current group can be deleted, so each group has a budget of its own:
+/// with a global one, the idle textures of a group could keep another over budget.
+void PhotoSphereTextureCache::evict(QOpenGLContextGroup *group)
+{
+    TextureCacheData &d = textureCacheData();
+    auto &textures = d.textures[group];
+    qint64 &groupBytes = d.groupBytes[group];
+    while (groupBytes > d.budget.load()) {
+        auto lru = textures.end();
+        for (auto it = textures.begin(); it != textures.end(); ++it) {
+            if (it->handle.isNull() && (lru == textures.end() || it->lastUsed < lru->lastUsed))
+                lru = it;
+        }
+        if (lru == textures.end())
+            return; // all in use
+        groupBytes -= lru->bytes;
+        d.bytesUsed.fetchAndSubOrdered(lru->bytes);
+        textures.erase(lru);
+    }
+}
+
+void PhotoSphereTextureCache::releaseGroup(QOpenGLContextGroup *group)
+{
+    TextureCacheData &d = textureCacheData();
+    QMutexLocker locker(&d.mutex);
+    const auto textures = d.textures.take(group);
+    d.groupBytes.remove(group);
+    for (const auto &entry : textures)
+        d.bytesUsed.fetchAndSubOrdered(entry.bytes);
+}
+
+void PhotoSphereTextureCache::setMemoryBudget(qint64 bytes)
+{
+    textureCacheData().budget.store(qMax<qint64>(0, bytes));
+}
+
+qint64 PhotoSphereTextureCache::memoryBudget()
+{
+    return textureCacheData().budget.load();
+}
+
+qint64 PhotoSphereTextureCache::memoryUsage()
+{
+    return textureCacheData().bytesUsed.load();
+}
+
+qint64 PhotoSphereTextureCache::textureBytes(const QOpenGLTexture *texture)
+{
+    qint64 bytesPerPixel = 4;
+    switch (texture->format()) {
+    case QOpenGLTexture::RGB8_UNorm:
+        bytesPerPixel = 3;
+        break;
+    default:
+        break;
+    }
+    int blockWidth = 1;
+    int blockHeight = 1;
+    int blockBytes = 0;
+    if (PhotoSphereCompressedTexture::blockInfo(texture->format(), &blockWidth, &blockHeight, &blockBytes))
+        bytesPerPixel = blockBytes; // per block, actually
+
+    const int faces = (texture->target() == QOpenGLTexture::TargetCubeMap) ? 6 : 1;
+    const int levels = qMax(1, texture->mipLevels());
+    qint64 bytes = 0;
+    for (int level = 0; level < levels; ++level) {
+        // in blocks, for compressed formats
+        const qint64 w = (qMax(1, texture->width() >> level) + blockWidth - 1) / blockWidth;
+        const qint64 h = (qMax(1, texture->height() >> level) + blockHeight - 1) / blockHeight;
+        bytes += w * h * bytesPerPixel;
+    }
+    return bytes * faces;
+}
@@ -0,0 +1,216 @@
+/****************************************************************************
+**
+** Copyright (C) 2023- Paolo Angelelli <paolo.angelelli@gmail.com>
+**
+** Commercial License Usage
+** Licensees holding a valid commercial QmlPanorama license may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement with the copyright holder. For licensing terms
+** and conditions and further information contact the copyright holder.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3. The licenses are as published by
+** the Free Software Foundation at https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef PHOTOSPHERECACHE_H
+#define PHOTOSPHERECACHE_H
+
+#include "photosphere.h"
+#include "photospherektx.h"
+#include <QObject>
+#include <QImage>
+#include <QUrl>
+#include <QHash>
+#include <QMap>
+#include <QPair>
+#include <QVector>
+#include <QSharedPointer>
+#include <QWeakPointer>
+#include <QPointer>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+#include <functional>
+
+/// Timings of the loading stages, and of the frames, logged as debug messages.
+/// Disabled by default, enabled with QT_LOGGING_RULES="qmlpanorama.stats.debug=true".
+Q_DECLARE_LOGGING_CATEGORY(lcPhotoSphereStats)
+
+class QOpenGLTexture;
+class QNetworkReply;
+class QOpenGLContextGroup;
+struct PhotoSphereQueuedDecode;
+
+/// PhotoSphereImage is a source image, fetched and decoded for a given maximum texture size.
+/// Instances are shared, through PhotoSphereImageCache, by all the PhotoSphere items
+/// displaying or loading the same source. Lives in the GUI thread.
+/// Destroying an image still loading aborts its fetch, or cancels its decode if not started yet.
+class PhotoSphereImage : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Status {
+        Loading,
+        Ready,
+        Error
+    };
+
+    /// Low priority images, like prefetched ones, are fetched and decoded after the others
+    enum Priority {
+        NormalPriority,
+        LowPriority
+    };
+
+    /// Equirectangular images can be converted to cube maps after decoding, see
+    /// PhotoSphereCubeConverter. Converted images have cubeFaces(), but no image().
+    enum Conversion {
+        NoConversion,
+        BilinearCubeMap,
+        BicubicCubeMap
+    };
+
+    /// The time spent in each loading stage, in milliseconds. Stages that did not run are 0.
+    /// Fetching is measured in the GUI thread, from the request to the last byte.
+    /// The other stages run in the thread pool.
+    struct Timings
+    {
+        qreal fetch = 0;
+        qreal decode = 0;     // reading and decoding, or loading converted cube faces
+        qreal scale = 0;      // scaling to the maximum texture size and converting to RGBA8888
+        qreal conversion = 0; // reprojecting to cube faces
+    };
+
+    ~PhotoSphereImage() override;
+
+    QUrl url() const { return m_url; }
+    int maxTexSize() const { return m_maxTexSize; }
+    Conversion conversion() const { return m_conversion; }
+    Status status() const { return m_status; }
+    /// The decoded image, in a format ready to be uploaded. Null until Ready, or for compressed sources.
+    QImage image() const { return m_image; }
+    /// The compressed texture data, for KTX sources. Null until Ready, or for other sources.
+    PhotoSphereCompressedTexture compressed() const { return m_compressed; }
+    /// The faces converted from the decoded image, each no larger than maxTexSize().
+    /// Empty until Ready, without conversion, or for compressed sources, which are not converted.
+    QMap<CubeFace, QImage> cubeFaces() const { return m_faces; }
+    /// The encoded image, as fetched. Empty for local files, which are decoded in place.
+    QByteArray data() const { return m_data; }
+    qint64 bytesReceived() const { return m_bytesReceived; }
+    qint64 bytesTotal() const { return m_bytesTotal; }
+    /// Valid once Ready
+    Timings timings() const { return m_timings; }
+
+signals:
+    void progress(qint64 received, qint64 total);
+    /// Emitted once, when status changes to either Ready or Error
+    void finished();
+
+private:
+    PhotoSphereImage(const QUrl &url, int maxTexSize, Priority priority, Conversion conversion);
+    void fetch();
+    void decode();
+    void raisePriority();
+    void onDecoded(const QImage &image, const PhotoSphereCompressedTexture &compressed,
+                   const QMap<CubeFace, QImage> &faces, const Timings &timings);
+    void finish(Status status);
+
+    QUrl m_url;
+    int m_maxTexSize;
+    Priority m_priority;
+    Conversion m_conversion;
+    Status m_status = Loading;
+    QByteArray m_data;
+    QString m_localFile; // set for file: and qrc: urls, mapped instead of fetched
+    QImage m_image;
+    PhotoSphereCompressedTexture m_compressed;
+    QMap<CubeFace, QImage> m_faces;
+    qint64 m_bytesReceived = 0;
+    qint64 m_bytesTotal = -1;
+    Timings m_timings;
+    QElapsedTimer m_fetchTimer;
+    QPointer<QNetworkReply> m_reply;
+    QSharedPointer<QAtomicInt> m_cancelled; // shared with the decode job
+    QSharedPointer<PhotoSphereQueuedDecode> m_queuedDecode; // shared with the decode job
+
+    friend class PhotoSphereImageCache;
+    Q_DISABLE_COPY(PhotoSphereImage)
+};
+
+/// PhotoSphereImageCache deduplicates fetching and decoding of the same source among
+/// PhotoSphere items. An image stays in the cache as long as it is referenced.
+/// GUI thread only.
+class PhotoSphereImageCache
+{
+public:
+    static PhotoSphereImageCache *instance();
+
+    /// Returns the image for url decoded for maxTexSize, and converted as requested, starting to
+    /// load it if not cached.
+    /// Data already fetched for the same url, at another size, is decoded again instead of being fetched.
+    /// A cached low priority image requested with normal priority is raised to normal: its fetch
+    /// keeps the priority it started with, but its decode is queued again if it has not started.
+    QSharedPointer<PhotoSphereImage> image(const QUrl &url, int maxTexSize,
+                                           PhotoSphereImage::Priority priority = PhotoSphereImage::NormalPriority,
+                                           PhotoSphereImage::Conversion conversion = PhotoSphereImage::NoConversion);
+
+    /// The directory of the HTTP disk cache used for fetching. An empty path disables it.
+    /// Defaults to a subdirectory of QStandardPaths::CacheLocation.
+    /// Converted cube maps are stored in a subdirectory of it, with a budget of their own, also of
+    /// diskCacheSize(), so that the two together take up to twice that.
+    static void setDiskCacheDirectory(const QString &path);
+    static QString diskCacheDirectory();
+    /// The maximum size of the HTTP disk cache, in bytes, and separately of the converted cube
+    /// maps. Defaults to 128 MB.
+    static void setDiskCacheSize(qint64 bytes);
+    static qint64 diskCacheSize();
+
+private:
+    QByteArray cachedData(const QUrl &url) const;
+    void prune();
+
+    QHash<QPair<QUrl, QPair<int, int>>, QWeakPointer<PhotoSphereImage>> m_images; // by maxTexSize, conversion
+};
+
+/// PhotoSphereTextureCache shares the textures created from the same images among the
+/// PhotoSphere renderers of an OpenGL context share group, so that N views of a
+/// panorama cost a single GPU allocation.
+/// Textures are identified by the QImage::cacheKey() of the image(s) they are created from.
+/// Textures no longer used by any renderer are kept, so that showing them again is free,
+/// as long as the memory used by the textures of the share group stays within memoryBudget().
+/// Past that, the least recently shown ones of the group are evicted. Each share group has
+/// a budget of its own, as textures can only be deleted with a context of their group current.
+/// Windows that don't share contexts can therefore use up to memoryBudget() each.
+/// Render thread only, with the context current. Thread-safe across render threads,
+/// except for the budget accessors, that can be used from any thread.
+class PhotoSphereTextureCache
+{
+public:
+    using Key = QVector<qint64>;
+
+    /// Returns the texture for key, using create to create it if missing.
+    /// create may return nullptr.
+    static QSharedPointer<QOpenGLTexture> texture(const Key &key,
+                                                  const std::function<QOpenGLTexture *()> &create);
+
+    /// Sets the memory budget of each share group, in bytes. Enforced at the next use of the cache
+    /// in each render thread. Textures in use are never evicted.
+    static void setMemoryBudget(qint64 bytes);
+    static qint64 memoryBudget();
+    /// The memory used by the cached textures of all share groups, in use or not, including mip maps.
+    static qint64 memoryUsage();
+
+    /// The memory used by texture, including mip maps.
+    static qint64 textureBytes(const QOpenGLTexture *texture);
+
+private:
+    static void release(QOpenGLContextGroup *group, const Key &key);
+    static void evict(QOpenGLContextGroup *group);
+    static void releaseGroup(QOpenGLContextGroup *group);
+};
+
+#endif // PHOTOSPHERECACHE_H
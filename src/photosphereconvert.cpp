@@ -0,0 +1,323 @@
+/****************************************************************************
+**
+** Copyright (C) 2023- Paolo Angelelli <paolo.angelelli@gmail.com>
+**
+** Commercial License Usage
+** Licensees holding a valid commercial QmlPanorama license may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement with the copyright holder. For licensing terms
+** and conditions and further information contact the copyright holder.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3. The licenses are as published by
+** the Free Software Foundation at https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "photosphereconvert.h"
+#include "photospheretiles.h"
+#include "photosphereutils_p.h"
+#include <QCryptographicHash>
+#include <QThreadPool>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QSharedPointer>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDebug>
+#include <array>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace {
+constexpr int bandRows = 32;
+constexpr int faceCount = 6;
+constexpr float pi = 3.14159265358979f;
+
+const std::array<const char *, faceCount> faceNames {{ "px", "py", "pz", "mx", "my", "mz" }};
+
+inline int wrap(int x, int width)
+{
+    x %= width;
+    return (x < 0) ? x + width : x;
+}
+
+/// atan2 within 2e-6 radians, a hundredth of a pixel of a 16K panorama. Unlike std::atan2, a
+/// polynomial with selects instead of branches, that vectorizes.
+inline float atan2Approx(float y, float x)
+{
+    const float ax = std::fabs(x);
+    const float ay = std::fabs(y);
+    const float mn = ax < ay ? ax : ay;
+    const float mx = ax < ay ? ay : ax;
+    const float a = mn / (mx > std::numeric_limits<float>::min() ? mx : std::numeric_limits<float>::min());
+    const float a2 = a * a;
+    float r = a * (0.99997726f + a2 * (-0.33262347f + a2 * (0.19354346f + a2 * (-0.11643287f
+                   + a2 * (0.05265332f + a2 * -0.01172120f)))));
+    r = (ay > ax) ? 0.5f * pi - r : r;
+    r = (x < 0.f) ? pi - r : r;
+    return (y < 0.f) ? -r : r;
+}
+
+inline float catmullRom(float p0, float p1, float p2, float p3, float t)
+{
+    return p1 + 0.5f * t * (p2 - p0 + t * (2.f * p0 - 5.f * p1 + 4.f * p2 - p3
+                                           + t * (3.f * (p1 - p2) + p3 - p0)));
+}
+
+inline uchar toByte(float v)
+{
+    return uchar(qBound(0, int(v + 0.5f), 255));
+}
+
+/// The state of a conversion, shared by the calling thread and the helper jobs.
+/// Rows of all the faces are split in bands, claimed in order by whichever thread is free.
+struct Conversion
+{
+    QImage source;
+    int faceSize = 0;
+    PhotoSphereCubeConverter::Filter filter = PhotoSphereCubeConverter::Bilinear;
+    std::array<uchar *, faceCount> faceBits {};
+    int faceStride = 0;
+    int bandsPerFace = 0;
+    int bandCount = 0;
+    QAtomicInt nextBand = 0;
+    QAtomicInt doneBands = 0;
+    QMutex mutex;
+    QWaitCondition done;
+
+    void mapRow(CubeFace face, int y, float *px, float *py) const;
+    void sampleBilinear(const float *px, const float *py, uchar *dst) const;
+    void sampleBicubic(const float *px, const float *py, uchar *dst) const;
+    /// px and py are scratch arrays of faceSize
+    void convertRow(CubeFace face, int y, uchar *dst, float *px, float *py) const;
+    /// Converts bands until none are left
+    void work();
+};
+
+/// Maps each pixel of row y of face to the point it samples in the source, in source pixels.
+/// Branch free, on plain float arrays, so that the compiler vectorizes it.
+void Conversion::mapRow(CubeFace face, int y, float *px, float *py) const
+{
+    const float width = source.width();
+    const float height = source.height();
+
+    // Face points are linear in u and v
+    const QVector3D d0 = PhotoSphereTileLayout::facePoint(face, 0, 0);
+    const QVector3D du = (PhotoSphereTileLayout::facePoint(face, 1, 0) - d0) / float(faceSize);
+    const QVector3D dv = (PhotoSphereTileLayout::facePoint(face, 0, 1) - d0) / float(faceSize);
+    const QVector3D first = d0 + du * 0.5f + dv * (y + 0.5f);
+    const float x0 = first.x(), y0 = first.y(), z0 = first.z();
+    const float ux = du.x(), uy = du.y(), uz = du.z();
+
+    for (int x = 0; x < faceSize; ++x) {
+        const float dx = x0 + ux * x;
+        const float dy = y0 + uy * x;
+        const float dz = z0 + uz * x;
+        // The same mapping as the equirectangular renderers
+        float s = 1.25f - atan2Approx(-dz, dx) * (0.5f / pi); // in [0.75, 1.75]
+        s = (s >= 1.f) ? s - 1.f : s;
+        const float t = 0.5f - atan2Approx(dy, std::sqrt(dx * dx + dz * dz)) * (1.f / pi);
+        px[x] = s * width - 0.5f;
+        py[x] = t * height - 0.5f;
+    }
+}
+
+void Conversion::sampleBilinear(const float *px, const float *py, uchar *dst) const
+{
+    const int width = source.width();
+    const int height = source.height();
+    const qint64 stride = source.bytesPerLine();
+    const uchar *src = source.constBits();
+
+    for (int x = 0; x < faceSize; ++x, dst += 4) {
+        const int x0 = int(std::floor(px[x]));
+        const int y0 = int(std::floor(py[x]));
+        const float fx = px[x] - x0;
+        const float fy = py[x] - y0;
+        const uchar *r0 = src + stride * qBound(0, y0, height - 1);
+        const uchar *r1 = src + stride * qBound(0, y0 + 1, height - 1);
+        const int c0 = wrap(x0, width) * 4;
+        const int c1 = wrap(x0 + 1, width) * 4;
+        for (int c = 0; c < 4; ++c) {
+            const float top = r0[c0 + c] + (r0[c1 + c] - r0[c0 + c]) * fx;
+            const float bottom = r1[c0 + c] + (r1[c1 + c] - r1[c0 + c]) * fx;
+            dst[c] = toByte(top + (bottom - top) * fy);
+        }
+    }
+}
+
+void Conversion::sampleBicubic(const float *px, const float *py, uchar *dst) const
+{
+    const int width = source.width();
+    const int height = source.height();
+    const qint64 stride = source.bytesPerLine();
+    const uchar *src = source.constBits();
+
+    for (int x = 0; x < faceSize; ++x, dst += 4) {
+        const int x0 = int(std::floor(px[x]));
+        const int y0 = int(std::floor(py[x]));
+        const float fx = px[x] - x0;
+        const float fy = py[x] - y0;
+        std::array<const uchar *, 4> rows;
+        std::array<int, 4> columns;
+        for (int i = 0; i < 4; ++i) {
+            rows[i] = src + stride * qBound(0, y0 - 1 + i, height - 1);
+            columns[i] = wrap(x0 - 1 + i, width) * 4;
+        }
+        for (int c = 0; c < 4; ++c) {
+            std::array<float, 4> v;
+            for (int i = 0; i < 4; ++i)
+                v[i] = catmullRom(rows[i][columns[0] + c], rows[i][columns[1] + c],
+                                  rows[i][columns[2] + c], rows[i][columns[3] + c], fx);
+            dst[c] = toByte(catmullRom(v[0], v[1], v[2], v[3], fy));
+        }
+    }
+}
+
+/// Converts a row in two passes: the mapping, vectorized, then the gathering of the samples,
+/// with the filter chosen once per row
+void Conversion::convertRow(CubeFace face, int y, uchar *dst, float *px, float *py) const
+{
+    mapRow(face, y, px, py);
+    if (filter == PhotoSphereCubeConverter::Bicubic)
+        sampleBicubic(px, py, dst);
+    else
+        sampleBilinear(px, py, dst);
+}
+
+void Conversion::work()
+{
+    std::vector<float> px(faceSize);
+    std::vector<float> py(faceSize);
+    int band;
+    while ((band = nextBand.fetchAndAddRelaxed(1)) < bandCount) {
+        const int face = band / bandsPerFace;
+        const int firstRow = (band % bandsPerFace) * bandRows;
+        const int lastRow = qMin(firstRow + bandRows, faceSize);
+        for (int y = firstRow; y < lastRow; ++y)
+            convertRow(CubeFace(face), y, faceBits[face] + qint64(y) * faceStride, px.data(), py.data());
+        if (doneBands.fetchAndAddOrdered(1) + 1 == bandCount) {
+            QMutexLocker locker(&mutex);
+            done.wakeAll();
+        }
+    }
+}
+
+QString cubeMapDirectory(const QString &directory)
+{
+    return directory + QLatin1String("/cubemaps");
+}
+
+QString facePath(const QString &directory, const QByteArray &key, int face)
+{
+    return cubeMapDirectory(directory) + QLatin1Char('/') + QString::fromLatin1(key)
+            + QLatin1Char('_') + QLatin1String(faceNames[face]) + QLatin1String(".png");
+}
+}
+
+int PhotoSphereCubeConverter::faceSize(int equirectWidth, int maxSize)
+{
+    return qMax(1, qMin(maxSize, equirectWidth / 4));
+}
+
+QMap<CubeFace, QImage> PhotoSphereCubeConverter::convert(const QImage &equirect, int faceSize, Filter filter)
+{
+    QMap<CubeFace, QImage> faces;
+    if (equirect.isNull() || faceSize <= 0)
+        return faces;
+
+    QSharedPointer<Conversion> conversion(new Conversion);
+    conversion->source = equirect.convertToFormat(QImage::Format_RGBA8888);
+    conversion->faceSize = faceSize;
+    conversion->filter = filter;
+    for (int f = 0; f < faceCount; ++f) {
+        QImage face(faceSize, faceSize, QImage::Format_RGBA8888);
+        if (face.isNull()) {
+            qWarning() << "Failed allocating cube map faces of size "<< faceSize;
+            return QMap<CubeFace, QImage>();
+        }
+        conversion->faceBits[f] = face.bits();
+        conversion->faceStride = face.bytesPerLine();
+        faces.insert(CubeFace(f), face);
+    }
+    conversion->bandsPerFace = (faceSize + bandRows - 1) / bandRows;
+    conversion->bandCount = conversion->bandsPerFace * faceCount;
+
+    // Helpers hold a reference, so that those starting after the conversion is over are harmless
+    QThreadPool *pool = QThreadPool::globalInstance();
+    const int helpers = qMin(pool->maxThreadCount() - 1, conversion->bandCount - 1);
+    for (int i = 0; i < helpers; ++i)
+        pool->start(new PhotoSphereJob([conversion]() { conversion->work(); }), std::numeric_limits<int>::max());
+
+    // Also working here, rather than only waiting, so that this can't starve if all pool threads
+    // are busy, or if called from one of them.
+    conversion->work();
+    QMutexLocker locker(&conversion->mutex);
+    while (conversion->doneBands.loadAcquire() < conversion->bandCount)
+        conversion->done.wait(&conversion->mutex);
+    return faces;
+}
+
+QByteArray PhotoSphereCubeConverter::key(const QByteArray &source, int maxSize, Filter filter)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(source);
+    hash.addData(QByteArray::number(maxSize) + '_' + QByteArray::number(int(filter)));
+    return hash.result().toHex();
+}
+
+QMap<CubeFace, QImage> PhotoSphereCubeConverter::load(const QString &directory, const QByteArray &key)
+{
+    QMap<CubeFace, QImage> faces;
+    if (directory.isEmpty())
+        return faces;
+    for (int f = 0; f < faceCount; ++f) {
+        QImage face(facePath(directory, key, f));
+        if (face.isNull() || face.width() != face.height())
+            return QMap<CubeFace, QImage>();
+        faces.insert(CubeFace(f), std::move(face).convertToFormat(QImage::Format_RGBA8888));
+    }
+    return faces;
+}
+
+void PhotoSphereCubeConverter::store(const QString &directory, const QByteArray &key,
+                                     const QMap<CubeFace, QImage> &faces, qint64 maxBytes)
+{
+    if (directory.isEmpty() || maxBytes <= 0 || faces.size() != faceCount)
+        return;
+    QDir dir(cubeMapDirectory(directory));
+    if (!dir.mkpath(QStringLiteral("."))) {
+        qWarning() << "Failed creating "<< dir.path();
+        return;
+    }
+    // PNG, not to add compression artifacts to every load after the first.
+    // Faces are opaque, so their alpha channel is not stored.
+    for (auto it = faces.cbegin(); it != faces.cend(); ++it) {
+        const QString path = facePath(directory, key, it.key());
+        if (!it.value().convertToFormat(QImage::Format_RGB32).save(path, "PNG"))
+            qWarning() << "Failed storing converted cube face to "<< path;
+    }
+
+    // Oldest first
+    const QFileInfoList files = dir.entryInfoList(QStringList() << QStringLiteral("*.png"),
+                                                  QDir::Files, QDir::Time | QDir::Reversed);
+    qint64 total = 0;
+    for (const QFileInfo &file : files)
+        total += file.size();
+    for (const QFileInfo &file : files) {
+        if (total <= maxBytes)
+            break;
+        total -= file.size();
+        QFile::remove(file.absoluteFilePath());
+    }
+}
@@ -0,0 +1,61 @@
+/****************************************************************************
+**
+** Copyright (C) 2023- Paolo Angelelli <paolo.angelelli@gmail.com>
+**
+** Commercial License Usage
+** Licensees holding a valid commercial QmlPanorama license may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement with the copyright holder. For licensing terms
+** and conditions and further information contact the copyright holder.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3. The licenses are as published by
+** the Free Software Foundation at https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef PHOTOSPHERECONVERT_H
+#define PHOTOSPHERECONVERT_H
+
+#include "photosphere.h"
+#include <QByteArray>
+#include <QString>
+#include <QImage>
+#include <QMap>
+
+/// PhotoSphereCubeConverter reprojects equirectangular images onto the six faces of a cube map,
+/// oriented as PhotoSphereRendererCube expects them. Unlike scaling an equirectangular image
+/// down to the maximum texture size, this keeps its angular resolution: a 16K wide image maps
+/// to six 4K faces. Thread-safe, meant to be used in the loading jobs.
+class PhotoSphereCubeConverter
+{
+public:
+    enum Filter {
+        Bilinear,
+        Bicubic
+    };
+
+    /// The face size matching the angular resolution of an equirectangular image of width,
+    /// which spans 4 faces around, limited to maxSize.
+    static int faceSize(int equirectWidth, int maxSize);
+
+    /// Reprojects equirect into six RGBA8888 faces of faceSize.
+    /// Rows are converted in bands, in parallel in the global QThreadPool. The calling thread
+    /// converts bands too, so that it can be a thread of the pool itself. Each row is mapped to
+    /// the source in a vectorized pass, then sampled in a scalar one, as the samples are gathers.
+    static QMap<CubeFace, QImage> convert(const QImage &equirect, int faceSize, Filter filter);
+
+    /// Identifies the conversion of a source for maxSize and filter. source identifies the
+    /// encoded image, either by where it comes from and its version, or by its data itself.
+    static QByteArray key(const QByteArray &source, int maxSize, Filter filter);
+    /// Loads the faces stored for key in directory, returning an empty map if not all are there
+    static QMap<CubeFace, QImage> load(const QString &directory, const QByteArray &key);
+    /// Stores faces for key in directory, losslessly, then removes the oldest stored faces until
+    /// all of them take less than maxBytes.
+    static void store(const QString &directory, const QByteArray &key,
+                      const QMap<CubeFace, QImage> &faces, qint64 maxBytes);
+};
+
+#endif // PHOTOSPHERECONVERT_H
@@ -0,0 +1,269 @@
+/****************************************************************************
+**
+** Copyright (C) 2023- Paolo Angelelli <paolo.angelelli@gmail.com>
+**
+** Commercial License Usage
+** Licensees holding a valid commercial QmlPanorama license may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement with the copyright holder. For licensing terms
+** and conditions and further information contact the copyright holder.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3. The licenses are as published by
+** the Free Software Foundation at https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "photospherektx.h"
+#include <QAtomicInteger>
+#include <QPair>
+#include <QtEndian>
+#include <QDebug>
+
+namespace {
+const char ktx1Identifier[] = "\xABKTX 11\xBB\r\n\x1A\n";
+const char ktx2Identifier[] = "\xABKTX 20\xBB\r\n\x1A\n";
+constexpr int identifierSize = 12;
+constexpr quint32 ktx1Endianness = 0x04030201;
+
+struct CompressedFormat
+{
+    quint32 vkFormat;   // the UNORM one, the SRGB one follows. 0 if not in Vulkan
+    quint32 glFormat;
+    quint32 glSrgbFormat;
+    int blockWidth;
+    int blockHeight;
+    int blockBytes;
+};
+
+const CompressedFormat compressedFormats[] = {
+    { 131, 0x83F0, 0x8C4C, 4, 4, 8 },   // BC1 RGB
+    { 133, 0x83F1, 0x8C4D, 4, 4, 8 },   // BC1 RGBA
+    { 135, 0x83F2, 0x8C4E, 4, 4, 16 },  // BC2
+    { 137, 0x83F3, 0x8C4F, 4, 4, 16 },  // BC3
+    { 145, 0x8E8C, 0x8E8D, 4, 4, 16 },  // BC7
+    { 147, 0x9274, 0x9275, 4, 4, 8 },   // ETC2 RGB8
+    { 149, 0x9276, 0x9277, 4, 4, 8 },   // ETC2 RGB8 A1
+    { 151, 0x9278, 0x9279, 4, 4, 16 },  // ETC2 RGBA8 EAC
+    { 0,   0x8D64, 0x8D64, 4, 4, 8 },   // ETC1
+    { 157, 0x93B0, 0x93D0, 4, 4, 16 },  // ASTC
+    { 159, 0x93B1, 0x93D1, 5, 4, 16 },
+    { 161, 0x93B2, 0x93D2, 5, 5, 16 },
+    { 163, 0x93B3, 0x93D3, 6, 5, 16 },
+    { 165, 0x93B4, 0x93D4, 6, 6, 16 },
+    { 167, 0x93B5, 0x93D5, 8, 5, 16 },
+    { 169, 0x93B6, 0x93D6, 8, 6, 16 },
+    { 171, 0x93B7, 0x93D7, 8, 8, 16 },
+    { 173, 0x93B8, 0x93D8, 10, 5, 16 },
+    { 175, 0x93B9, 0x93D9, 10, 6, 16 },
+    { 177, 0x93BA, 0x93DA, 10, 8, 16 },
+    { 179, 0x93BB, 0x93DB, 10, 10, 16 },
+    { 181, 0x93BC, 0x93DC, 12, 10, 16 },
+    { 183, 0x93BD, 0x93DD, 12, 12, 16 },
+};
+
+const CompressedFormat *findGlFormat(quint32 glFormat)
+{
+    for (const auto &format : compressedFormats) {
+        if (format.glFormat == glFormat || format.glSrgbFormat == glFormat)
+            return &format;
+    }
+    return nullptr;
+}
+
+const CompressedFormat *findVkFormat(quint32 vkFormat)
+{
+    for (const auto &format : compressedFormats) {
+        if (format.vkFormat && (format.vkFormat == vkFormat || format.vkFormat + 1 == vkFormat))
+            return &format;
+    }
+    return nullptr;
+}
+
+qint64 levelBytes(const CompressedFormat &format, int width, int height)
+{
+    const qint64 blocksX = (width + format.blockWidth - 1) / format.blockWidth;
+    const qint64 blocksY = (height + format.blockHeight - 1) / format.blockHeight;
+    return blocksX * blocksY * format.blockBytes;
+}
+
+/// Bounds checked reads of KTX header fields
+class KtxReader
+{
+public:
+    KtxReader(const QByteArray &data, bool swap) : m_data(data), m_swap(swap) { }
+
+    bool contains(qint64 offset, qint64 size) const
+    {
+        return offset >= 0 && size >= 0 && offset + size <= m_data.size();
+    }
+
+    quint32 u32(qint64 offset, bool *ok) const
+    {
+        if (!contains(offset, 4)) {
+            *ok = false;
+            return 0;
+        }
+        const quint32 v = qFromLittleEndian<quint32>(m_data.constData() + offset);
+        return m_swap ? qbswap(v) : v;
+    }
+
+    quint64 u64(qint64 offset, bool *ok) const
+    {
+        if (!contains(offset, 8)) {
+            *ok = false;
+            return 0;
+        }
+        return qFromLittleEndian<quint64>(m_data.constData() + offset);
+    }
+
+    /// Looks up the KTXorientation key in a key/value data block, returning true if
+    /// rows are stored top to bottom, the default.
+    bool isTopDown(qint64 offset, qint64 size) const
+    {
+        bool ok = true;
+        const qint64 end = offset + size;
+        while (ok && offset + 4 <= end) {
+            const quint32 entrySize = u32(offset, &ok);
+            if (!ok || !contains(offset + 4, entrySize))
+                break;
+            const QByteArray entry = QByteArray::fromRawData(m_data.constData() + offset + 4, int(entrySize));
+            const int separator = entry.indexOf('\0');
+            if (separator > 0 && entry.left(separator) == "KTXorientation") {
+                // "S=r,T=d" in KTX 1, "rd" in KTX2
+                const QByteArray value = entry.mid(separator + 1);
+                return !(value.contains("T=u") || value.startsWith("ru"));
+            }
+            offset += 4 + ((entrySize + 3) & ~3u);
+        }
+        return true;
+    }
+
+private:
+    const QByteArray &m_data;
+    bool m_swap;
+};
+}
+
+bool PhotoSphereCompressedTexture::isKtx(const QByteArray &data)
+{
+    return data.startsWith(QByteArray::fromRawData(ktx1Identifier, identifierSize))
+            || data.startsWith(QByteArray::fromRawData(ktx2Identifier, identifierSize));
+}
+
+bool PhotoSphereCompressedTexture::blockInfo(quint32 glInternalFormat, int *blockWidth,
+                                             int *blockHeight, int *blockBytes)
+{
+    const CompressedFormat *format = findGlFormat(glInternalFormat);
+    if (!format)
+        return false;
+    *blockWidth = format->blockWidth;
+    *blockHeight = format->blockHeight;
+    *blockBytes = format->blockBytes;
+    return true;
+}
+
+PhotoSphereCompressedTexture PhotoSphereCompressedTexture::fromKtx(const QByteArray &data, int maxSize)
+{
+    static QAtomicInteger<qint64> lastCacheKey = 0;
+    PhotoSphereCompressedTexture texture;
+    if (!isKtx(data))
+        return texture;
+
+    const bool ktx2 = data.startsWith(QByteArray::fromRawData(ktx2Identifier, identifierSize));
+    bool ok = true;
+    const CompressedFormat *format = nullptr;
+    int width = 0;
+    int height = 0;
+    bool topDown = true;
+    QVector<QPair<qint64, qint64>> levels; // offset and size, largest first
+
+    if (ktx2) {
+        const KtxReader r(data, false);
+        const quint32 vkFormat = r.u32(12, &ok);
+        width = int(r.u32(20, &ok));
+        height = int(r.u32(24, &ok));
+        const quint32 depth = r.u32(28, &ok);
+        const quint32 layers = r.u32(32, &ok);
+        const quint32 faces = r.u32(36, &ok);
+        const quint32 levelCount = qMax<quint32>(1, r.u32(40, &ok));
+        const quint32 supercompression = r.u32(44, &ok);
+        const quint32 kvdOffset = r.u32(56, &ok);
+        const quint32 kvdLength = r.u32(60, &ok);
+        if (!ok || depth || layers || faces != 1 || supercompression) {
+            qWarning() << "Unsupported KTX2 file: only single, not supercompressed, 2D images are supported";
+            return texture;
+        }
+        format = findVkFormat(vkFormat);
+        if (!format) {
+            qWarning() << "Unsupported KTX2 format: "<< vkFormat;
+            return texture;
+        }
+        for (quint32 i = 0; i < levelCount && ok; ++i) {
+            const qint64 offset = qint64(r.u64(80 + i * 24, &ok));
+            const qint64 size = qint64(r.u64(80 + i * 24 + 8, &ok));
+            levels.append(qMakePair(offset, size));
+        }
+        topDown = r.isTopDown(kvdOffset, kvdLength);
+    } else {
+        const quint32 endianness = KtxReader(data, false).u32(12, &ok);
+        const bool swap = endianness != ktx1Endianness;
+        if (swap && endianness != qbswap(ktx1Endianness))
+            ok = false;
+        const KtxReader r(data, swap);
+        const quint32 glType = r.u32(16, &ok);
+        const quint32 glFormat = r.u32(24, &ok);
+        const quint32 glInternalFormat = r.u32(28, &ok);
+        width = int(r.u32(36, &ok));
+        height = int(r.u32(40, &ok));
+        const quint32 depth = r.u32(44, &ok);
+        const quint32 arrayElements = r.u32(48, &ok);
+        const quint32 faces = r.u32(52, &ok);
+        const quint32 levelCount = qMax<quint32>(1, r.u32(56, &ok));
+        const quint32 kvdLength = r.u32(60, &ok);
+        if (!ok || glType || glFormat || depth || arrayElements || faces != 1) {
+            qWarning() << "Unsupported KTX file: only single 2D images in compressed formats are supported";
+            return texture;
+        }
+        format = findGlFormat(glInternalFormat);
+        if (!format) {
+            qWarning() << "Unsupported KTX format: "<< QByteArray::number(glInternalFormat, 16);
+            return texture;
+        }
+        topDown = r.isTopDown(64, kvdLength);
+        qint64 offset = 64 + qint64(kvdLength);
+        for (quint32 i = 0; i < levelCount && ok; ++i) {
+            const qint64 size = r.u32(offset, &ok);
+            levels.append(qMakePair(offset + 4, size));
+            offset += 4 + ((size + 3) & ~qint64(3));
+        }
+    }
+
+    if (!ok || width <= 0 || height <= 0) {
+        qWarning() << "Invalid KTX file";
+        return texture;
+    }
+
+    const KtxReader r(data, false);
+    for (int i = 0; i < levels.size(); ++i) {
+        const int w = qMax(1, width >> i);
+        const int h = qMax(1, height >> i);
+        if (!r.contains(levels.at(i).first, levels.at(i).second)
+                || levels.at(i).second != levelBytes(*format, w, h)) {
+            qWarning() << "Invalid KTX file: truncated or inconsistent level "<< i;
+            return PhotoSphereCompressedTexture();
+        }
+        if ((w > maxSize || h > maxSize) && i < levels.size() - 1)
+            continue; // too large, and a smaller one is there
+        if (texture.m_levels.isEmpty())
+            texture.m_size = QSize(w, h);
+        texture.m_levels.append(data.mid(int(levels.at(i).first), int(levels.at(i).second)));
+    }
+
+    texture.m_glInternalFormat = format->glFormat;
+    texture.m_topDown = topDown;
+    texture.m_cacheKey = -(++lastCacheKey);
+    return texture;
+}
@@ -0,0 +1,68 @@
+/****************************************************************************
+**
+** Copyright (C) 2023- Paolo Angelelli <paolo.angelelli@gmail.com>
+**
+** Commercial License Usage
+** Licensees holding a valid commercial QmlPanorama license may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement with the copyright holder. For licensing terms
+** and conditions and further information contact the copyright holder.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3. The licenses are as published by
+** the Free Software Foundation at https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef PHOTOSPHEREKTX_H
+#define PHOTOSPHEREKTX_H
+
+#include <QByteArray>
+#include <QVector>
+#include <QSize>
+
+/// PhotoSphereCompressedTexture holds GPU compressed texture data (ETC, BCn, ASTC), with all
+/// its mip levels, as read from KTX or KTX2 containers, ready to be uploaded as is.
+/// Cheap to copy, like QImage.
+class PhotoSphereCompressedTexture
+{
+public:
+    /// True if data starts with a KTX or KTX2 identifier
+    static bool isKtx(const QByteArray &data);
+
+    /// Parses KTX 1.1 or KTX2 data holding a single 2D image in a compressed format.
+    /// Supercompressed KTX2 (Basis, zstd) is not supported.
+    /// Levels larger than maxSize are skipped, as long as smaller ones are available.
+    /// Returns a null texture on failure.
+    static PhotoSphereCompressedTexture fromKtx(const QByteArray &data, int maxSize);
+
+    /// Block size, in pixels and bytes, of a compressed GL internal format.
+    /// Returns false for unsupported formats.
+    static bool blockInfo(quint32 glInternalFormat, int *blockWidth, int *blockHeight, int *blockBytes);
+
+    bool isNull() const { return m_levels.isEmpty(); }
+    /// The GL internal format. sRGB variants are reported as their linear counterpart,
+    /// as the renderers sample all the sources as non-linear data.
+    quint32 glInternalFormat() const { return m_glInternalFormat; }
+    /// The size of the first level
+    QSize size() const { return m_size; }
+    int width() const { return m_size.width(); }
+    int height() const { return m_size.height(); }
+    int levelCount() const { return m_levels.size(); }
+    QByteArray level(int level) const { return m_levels.at(level); }
+    /// True if the first row of the data is the top of the image, the KTX default
+    bool isTopDown() const { return m_topDown; }
+    /// Identifies the data like QImage::cacheKey(). Negative, not to collide with those.
+    qint64 cacheKey() const { return m_cacheKey; }
+
+private:
+    quint32 m_glInternalFormat = 0;
+    QSize m_size;
+    QVector<QByteArray> m_levels;
+    bool m_topDown = true;
+    qint64 m_cacheKey = 0;
+};
+
+#endif // PHOTOSPHEREKTX_H
@@ -0,0 +1,208 @@
+/****************************************************************************
+**
+** Copyright (C) 2023- Paolo Angelelli <paolo.angelelli@gmail.com>
+**
+** Commercial License Usage
+** Licensees holding a valid commercial QmlPanorama license may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement with the copyright holder. For licensing terms
+** and conditions and further information contact the copyright holder.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3. The licenses are as published by
+** the Free Software Foundation at https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef PHOTOSPHERERENDER_P_H
+#define PHOTOSPHERERENDER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QmlPanorama API. It holds the building blocks
+// of the renderers in photosphere.cpp that are also measured by the
+// benchmarks, and may change without notice.
+//
+
+#include "photospherecache.h"
+#include <QtGui/qopenglcontext.h>
+#include <QtGui/qopenglfunctions.h>
+#include <QtGui/QOpenGLTexture>
+#include <QtGui/QOpenGLBuffer>
+#include <QtGui/QOpenGLVertexArrayObject>
+#include <QScopedPointer>
+#include <QImage>
+#include <QList>
+#include <QVector>
+#include <QVector2D>
+#include <QVector3D>
+#include <QtMath>
+#include <cmath>
+
+/// The internal format of textures uploaded from RGBA8888 images, in the current context.
+/// OpenGL ES 2 has no sized internal formats.
+inline QOpenGLTexture::TextureFormat imageTextureFormat()
+{
+    QOpenGLContext *ctx = QOpenGLContext::currentContext();
+    return (ctx->isOpenGLES() && ctx->format().majorVersion() < 3)
+            ? QOpenGLTexture::RGBAFormat : QOpenGLTexture::RGBA8_UNorm;
+}
+
+/// PhotoSphereTextureUpload uploads a QImage into a new mipmapped 2D texture a band of rows
+/// per frame, so that large sources don't stall the render thread, the previous texture being
+/// drawn meanwhile. The result is the same as with QOpenGLTexture::setData(QImage).
+/// Without mipMaps, only the first level is allocated and uploaded.
+struct PhotoSphereTextureUpload
+{
+    static constexpr int maxBytesPerFrame = 8 * 1024 * 1024;
+
+    PhotoSphereTextureUpload(const PhotoSphereTextureCache::Key &k, const QImage &source)
+        : key(k), image(source.convertToFormat(QImage::Format_RGBA8888)) // already, once decoded
+    {
+    }
+
+    /// Uploads the next band of rows, allocating the texture first.
+    /// Returns true once all rows are uploaded, and the mip maps generated.
+    bool step(QOpenGLFunctions *f)
+    {
+        if (!texture) {
+            texture.reset(new QOpenGLTexture(QOpenGLTexture::Target2D));
+            texture->setFormat(imageTextureFormat());
+            texture->setSize(image.width(), image.height());
+            texture->setMipLevels(mipMaps ? texture->maximumMipLevels() : 1);
+            texture->allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8);
+        }
+
+        const int rows = qMin(qMax(1, maxBytesPerFrame / image.bytesPerLine()), image.height() - nextRow);
+        texture->bind();
+        f->glTexSubImage2D(GL_TEXTURE_2D, 0, 0, nextRow, image.width(), rows,
+                           GL_RGBA, GL_UNSIGNED_BYTE, image.constScanLine(nextRow));
+        texture->release();
+        nextRow += rows;
+        if (nextRow < image.height())
+            return false;
+
+        if (mipMaps) {
+            texture->generateMipMaps();
+            texture->setMaximumAnisotropy(16.0f);
+            texture->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
+        } else {
+            texture->setMinificationFilter(QOpenGLTexture::Linear);
+        }
+        texture->setMagnificationFilter(QOpenGLTexture::Linear);
+        return true;
+    }
+
+    PhotoSphereTextureCache::Key key;
+    QImage image;
+    QScopedPointer<QOpenGLTexture> texture;
+    int nextRow = 0;
+    bool mipMaps = true;
+};
+
+/// This utility struct encapsulates the geometry of a sphere and
+/// OpenGL code for rendering it. Assumes appropriate shader and
+/// texture unit to be bound.
+
+struct Sphere3D
+{
+    Sphere3D()
+    {
+    }
+
+    void generateSphere()
+    {
+        static constexpr double step = 0.015625; // 32 stacks, 64 sectors
+
+        static constexpr double pi = M_PI;
+        static constexpr double pi2 =  2.0 * pi;
+        static constexpr double di = step;
+        static constexpr double dj = step * 2.0;
+        static constexpr double du = di * 2.0 * pi;
+        static constexpr double dv = dj * pi;
+
+        for (double i = 0; i < 1.0; i += di)  //horizonal
+        for (double j = 0; j < 1.0; j += dj)  //vertical
+        {
+            double u = (i * pi2) + (M_PI_2); // azimuth, rotated 90 degrees to make 0 point to north
+            double v = (M_PI_2) - j * pi;         // elevation
+
+            QVector3D bl(cos(u) * cos(v - dv),       sin(v - dv), -sin(u) * cos(v - dv));
+            QVector3D br(cos(u + du) * cos(v - dv),  sin(v - dv), -sin(u + du) * cos(v - dv));
+            QVector3D tr(cos(u + du) * cos(v),       sin(v),      -sin(u + du) * cos(v));
+            QVector3D tl(cos(u) * cos(v),            sin(v),      -sin(u) * cos(v));
+
+            // nullify zeroes
+            QList<QVector3D *> vtx;
+            vtx << &bl << &br << &tr << &tl;
+            for(auto v: vtx) {
+                for (auto c = 0 ; c < 3; ++c) {
+                    if (qFuzzyIsNull((*v)[c]))
+                        (*v)[c] = 0;
+                }
+            }
+
+            QVector2D texBl(1.0 - i,        j + dj);
+            QVector2D texBr(1.0 - i - di,   j + dj);
+            QVector2D texTr(1.0 - i - di,   j);
+            QVector2D texTl(1.0 - i,        j);
+
+            m_sphereVertices << bl << tl << tr << bl << tr << br;
+            m_texCoords << texBl << texTl << texTr << texBl << texTr << texBr;
+        }
+    }
+
+    /// Generates the geometry and uploads it, the first time it is called
+    void init()
+    {
+        if (m_initialized)
+            return;
+        m_initialized = true;
+        generateSphere();
+        // vtx
+        m_vertexDataBuffer.create();
+        m_vertexDataBuffer.bind();
+        m_vertexDataBuffer.allocate(&m_sphereVertices.front(), m_sphereVertices.size() * sizeof(QVector3D));
+        m_vertexDataBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        m_vertexDataBuffer.release();
+        // texCoords
+        m_texCoordBuffer.create();
+        m_texCoordBuffer.bind();
+        m_texCoordBuffer.allocate(&m_texCoords.front(), m_texCoords.size() * sizeof(QVector2D));
+        m_texCoordBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        m_texCoordBuffer.release();
+
+        QOpenGLVertexArrayObject::Binder vaoBinder(&m_vao); // creates
+        QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+        m_vertexDataBuffer.bind();
+        f->glEnableVertexAttribArray(0);
+        f->glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+        m_vertexDataBuffer.release();
+        m_texCoordBuffer.bind();
+        f->glEnableVertexAttribArray(1);
+        f->glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
+        m_texCoordBuffer.release();
+    }
+
+    void drawSphere()
+    {
+        QOpenGLVertexArrayObject::Binder vaoBinder(&m_vao);
+        QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+        f->glDrawArrays(GL_TRIANGLES, 0, m_sphereVertices.size());
+    }
+
+    QOpenGLVertexArrayObject m_vao;
+
+    QOpenGLBuffer m_vertexDataBuffer;
+    QOpenGLBuffer m_texCoordBuffer;
+    QVector<QVector3D> m_sphereVertices;
+    QVector<QVector2D> m_texCoords;
+
+    bool m_initialized = false;
+};
+
+#endif // PHOTOSPHERERENDER_P_H
@@ -0,0 +1,56 @@
+/****************************************************************************
+**
+** Copyright (C) 2023- Paolo Angelelli <paolo.angelelli@gmail.com>
+**
+** Commercial License Usage
+** Licensees holding a valid commercial QmlPanorama license may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement with the copyright holder. For licensing terms
+** and conditions and further information contact the copyright holder.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3. The licenses are as published by
+** the Free Software Foundation at https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "photospherestats.h"
+
+bool PhotoSphereStats::Load::operator==(const Load &other) const
+{
+    return fetchTime == other.fetchTime
+            && decodeTime == other.decodeTime
+            && scaleTime == other.scaleTime
+            && conversionTime == other.conversionTime
+            && uploadTime == other.uploadTime
+            && textureBytes == other.textureBytes;
+}
+
+bool PhotoSphereStats::Frames::operator==(const Frames &other) const
+{
+    return synchronizeTime == other.synchronizeTime
+            && renderTime == other.renderTime
+            && frameRate == other.frameRate;
+}
+
+PhotoSphereStats::PhotoSphereStats(QObject *parent) : QObject(parent)
+{
+}
+
+void PhotoSphereStats::setLoad(const Load &load)
+{
+    if (load == m_load)
+        return;
+    m_load = load;
+    emit loadStatsChanged();
+}
+
+void PhotoSphereStats::setFrames(const Frames &frames)
+{
+    if (frames == m_frames)
+        return;
+    m_frames = frames;
+    emit frameStatsChanged();
+}
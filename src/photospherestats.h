@@ -0,0 +1,171 @@
+/****************************************************************************
+**
+** Copyright (C) 2023- Paolo Angelelli <paolo.angelelli@gmail.com>
+**
+** Commercial License Usage
+** Licensees holding a valid commercial QmlPanorama license may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement with the copyright holder. For licensing terms
+** and conditions and further information contact the copyright holder.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3. The licenses are as published by
+** the Free Software Foundation at https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef PHOTOSPHERESTATS_H
+#define PHOTOSPHERESTATS_H
+
+#include <QObject>
+
+/*!
+    \qmltype PhotoSphereStats
+    \instantiates PhotoSphereStats
+    \inqmlmodule QmlPanorama
+
+    \brief The PhotoSphereStats type reports where the time goes in a
+    PhotoSphere. It can't be created, and is available as PhotoSphere::stats.
+
+    Load statistics refer to the source currently displayed, and change with
+    each load, and again once its textures are uploaded. Frame statistics are
+    averaged over the frames of about the last half second, and are updated
+    while the item renders.
+    All the times are in milliseconds.
+*/
+class PhotoSphereStats : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(qreal fetchTime READ fetchTime NOTIFY loadStatsChanged)
+    Q_PROPERTY(qreal decodeTime READ decodeTime NOTIFY loadStatsChanged)
+    Q_PROPERTY(qreal scaleTime READ scaleTime NOTIFY loadStatsChanged)
+    Q_PROPERTY(qreal conversionTime READ conversionTime NOTIFY loadStatsChanged)
+    Q_PROPERTY(qreal uploadTime READ uploadTime NOTIFY loadStatsChanged)
+    Q_PROPERTY(qint64 textureBytes READ textureBytes NOTIFY loadStatsChanged)
+    Q_PROPERTY(qreal synchronizeTime READ synchronizeTime NOTIFY frameStatsChanged)
+    Q_PROPERTY(qreal renderTime READ renderTime NOTIFY frameStatsChanged)
+    Q_PROPERTY(qreal frameRate READ frameRate NOTIFY frameStatsChanged)
+
+public:
+    struct Load
+    {
+        qreal fetchTime = 0;
+        qreal decodeTime = 0;
+        qreal scaleTime = 0;
+        qreal conversionTime = 0;
+        qreal uploadTime = 0;
+        qint64 textureBytes = 0;
+
+        bool operator==(const Load &other) const;
+    };
+
+    struct Frames
+    {
+        qreal synchronizeTime = 0;
+        qreal renderTime = 0;
+        qreal frameRate = 0;
+
+        bool operator==(const Frames &other) const;
+    };
+
+    explicit PhotoSphereStats(QObject *parent = nullptr);
+
+/*!
+    \qmlproperty real PhotoSphereStats::fetchTime
+
+    This property holds the time spent fetching the source from the network,
+    from the request to the last byte. For cube maps, the longest of the six
+    fetches, as they run in parallel. Local files are not fetched, but read
+    while decoding.
+ */
+    qreal fetchTime() const { return m_load.fetchTime; }
+
+/*!
+    \qmlproperty real PhotoSphereStats::decodeTime
+
+    This property holds the time spent reading and decoding the source,
+    summed over all its images.
+ */
+    qreal decodeTime() const { return m_load.decodeTime; }
+
+/*!
+    \qmlproperty real PhotoSphereStats::scaleTime
+
+    This property holds the time spent scaling the decoded images to the
+    maximum texture size, and converting them to the format uploaded,
+    summed over all the images of the source.
+ */
+    qreal scaleTime() const { return m_load.scaleTime; }
+
+/*!
+    \qmlproperty real PhotoSphereStats::conversionTime
+
+    This property holds the time spent converting an equirectangular source
+    to a cube map, see PhotoSphere::cubeMapConversion. 0 if not converted,
+    or if the conversion was found in the disk cache.
+ */
+    qreal conversionTime() const { return m_load.conversionTime; }
+
+/*!
+    \qmlproperty real PhotoSphereStats::uploadTime
+
+    This property holds the time the render thread spent uploading the
+    textures of the source, summed over the frames the upload spans.
+    0 until uploaded, or if the textures were already cached.
+ */
+    qreal uploadTime() const { return m_load.uploadTime; }
+
+/*!
+    \qmlproperty int PhotoSphereStats::textureBytes
+
+    This property holds the GPU memory used by the textures of the source,
+    mip maps included. These may be shared with other PhotoSphere items.
+ */
+    qint64 textureBytes() const { return m_load.textureBytes; }
+
+/*!
+    \qmlproperty real PhotoSphereStats::synchronizeTime
+
+    This property holds the average time per frame the render thread spends
+    preparing the frame, while the GUI thread is blocked.
+ */
+    qreal synchronizeTime() const { return m_frames.synchronizeTime; }
+
+/*!
+    \qmlproperty real PhotoSphereStats::renderTime
+
+    This property holds the average time per frame the render thread spends
+    issuing the draw calls and texture uploads of the item. This is CPU time:
+    the GPU executes them later.
+ */
+    qreal renderTime() const { return m_frames.renderTime; }
+
+/*!
+    \qmlproperty real PhotoSphereStats::frameRate
+
+    This property holds the number of frames rendered per second. Frames are
+    only rendered when something changes, and the averages are not updated
+    while idle.
+ */
+    qreal frameRate() const { return m_frames.frameRate; }
+
+    Load load() const { return m_load; }
+    void setLoad(const Load &load);
+    Frames frames() const { return m_frames; }
+    void setFrames(const Frames &frames);
+
+signals:
+    void loadStatsChanged();
+    void frameStatsChanged();
+
+private:
+    Load m_load;
+    Frames m_frames;
+
+    Q_DISABLE_COPY(PhotoSphereStats)
+};
+
+#endif // PHOTOSPHERESTATS_H
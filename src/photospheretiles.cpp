@@ -0,0 +1,229 @@
+/****************************************************************************
+**
+** Copyright (C) 2023- Paolo Angelelli <paolo.angelelli@gmail.com>
+**
+** Commercial License Usage
+** Licensees holding a valid commercial QmlPanorama license may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement with the copyright holder. For licensing terms
+** and conditions and further information contact the copyright holder.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3. The licenses are as published by
+** the Free Software Foundation at https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "photospheretiles.h"
+#include "photosphereutils_p.h"
+#include <QtMath>
+#include <QDebug>
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace {
+// Marzipano face names. Front is PositiveZ, so right is NegativeX.
+const QMap<CubeFace, QString> defaultFaceNames {{
+        {CubeFace::PZ, "f"},
+        {CubeFace::MZ, "b"},
+        {CubeFace::PX, "l"},
+        {CubeFace::MX, "r"},
+        {CubeFace::PY, "u"},
+        {CubeFace::MY, "d"}
+}};
+
+qreal angleBetween(const QVector3D &v1, const QVector3D &v2)
+{
+    return std::acos(qBound(-1.0f, QVector3D::dotProduct(v1, v2), 1.0f));
+}
+
+/// The direction of the center of r on face, and the angular radius of r around it
+qreal angularExtent(CubeFace face, const QRectF &r, QVector3D *center)
+{
+    *center = PhotoSphereTileLayout::facePoint(face, r.center().x(), r.center().y()).normalized();
+    const std::array<QPointF, 4> corners {{ r.topLeft(), r.topRight(), r.bottomRight(), r.bottomLeft() }};
+    qreal radius = 0;
+    for (const QPointF &c : corners) {
+        const QVector3D corner = PhotoSphereTileLayout::facePoint(face, c.x(), c.y()).normalized();
+        radius = qMax(radius, angleBetween(*center, corner));
+    }
+    return radius;
+}
+}
+
+bool PhotoSphereTileLayout::isTiledSource(const QVariantMap &map)
+{
+    return map.contains(QStringLiteral("tileUrl"));
+}
+
+PhotoSphereTileLayout PhotoSphereTileLayout::fromVariantMap(const QVariantMap &map)
+{
+    PhotoSphereTileLayout layout;
+    layout.m_urlTemplate = map.value(QStringLiteral("tileUrl")).toString();
+    if (layout.m_urlTemplate.isEmpty() || !QUrl(layout.m_urlTemplate).isValid()) {
+        qWarning() << "Invalid tileUrl in tiled source: "<< map.value(QStringLiteral("tileUrl"));
+        return PhotoSphereTileLayout();
+    }
+
+    bool ok = false;
+    const int tileSize = map.value(QStringLiteral("tileSize")).toInt(&ok);
+    if (!ok || tileSize <= 0) {
+        qWarning() << "Invalid tileSize in tiled source: "<< map.value(QStringLiteral("tileSize"));
+        return PhotoSphereTileLayout();
+    }
+
+    const QVariantList levels = map.value(QStringLiteral("levels")).toList();
+    for (const QVariant &l : levels) {
+        const int size = l.toInt(&ok);
+        if (!ok || size <= 0 || (!layout.m_levels.isEmpty() && size <= layout.m_levels.last())) {
+            qWarning() << "levels in tiled source must be increasing face sizes: "<< levels;
+            return PhotoSphereTileLayout();
+        }
+        layout.m_levels.append(size);
+    }
+    if (layout.m_levels.isEmpty()) {
+        qWarning() << "Missing levels in tiled source";
+        return PhotoSphereTileLayout();
+    }
+
+    layout.m_faceNames = defaultFaceNames;
+    const QVariantMap faces = map.value(QStringLiteral("faces")).toMap();
+    for (auto it = faces.cbegin(); it != faces.cend(); ++it) {
+        if (!nameToCubeFace().contains(it.key())) {
+            qWarning() << "Invalid face in tiled source: "<< it.key();
+            return PhotoSphereTileLayout();
+        }
+        layout.m_faceNames[nameToCubeFace().value(it.key())] = it.value().toString();
+    }
+
+    layout.m_tileSize = tileSize;
+    return layout;
+}
+
+QUrl PhotoSphereTileLayout::tileUrl(const PhotoSphereTileId &tile) const
+{
+    QString url = m_urlTemplate;
+    url.replace(QLatin1String("{f}"), m_faceNames.value(tile.face));
+    url.replace(QLatin1String("{z}"), QString::number(tile.level));
+    url.replace(QLatin1String("{l}"), QString::number(tile.level + 1));
+    url.replace(QLatin1String("{x}"), QString::number(tile.x));
+    url.replace(QLatin1String("{y}"), QString::number(tile.y));
+    return QUrl(url);
+}
+
+QRectF PhotoSphereTileLayout::tileRect(const PhotoSphereTileId &tile) const
+{
+    const qreal size = m_levels.at(tile.level);
+    const qreal x0 = tile.x * m_tileSize;
+    const qreal y0 = tile.y * m_tileSize;
+    const qreal x1 = qMin(size, x0 + m_tileSize);
+    const qreal y1 = qMin(size, y0 + m_tileSize);
+    return QRectF(QPointF(x0 / size, y0 / size), QPointF(x1 / size, y1 / size));
+}
+
+QVector<PhotoSphereTileId> PhotoSphereTileLayout::tiles(int level) const
+{
+    QVector<PhotoSphereTileId> res;
+    const int n = tilesPerSide(level);
+    for (int f = CubeFace::PX; f != CubeFace::InvalidFace; f++ ) {
+        for (int y = 0; y < n; ++y) {
+            for (int x = 0; x < n; ++x)
+                res.append(PhotoSphereTileId{CubeFace(f), level, x, y});
+        }
+    }
+    return res;
+}
+
+int PhotoSphereTileLayout::levelFor(qreal viewportHeight, qreal fov) const
+{
+    // A face spans 2 units at distance 1, the viewport 2 * tan(fov / 2)
+    const qreal required = viewportHeight / std::tan(qDegreesToRadians(fov) * 0.5);
+    for (int level = 0; level < m_levels.size(); ++level) {
+        if (m_levels.at(level) >= required)
+            return level;
+    }
+    return m_levels.size() - 1;
+}
+
+QVector<PhotoSphereTileId> PhotoSphereTileLayout::visibleTiles(int level, const QVector3D &viewDir,
+                                                               qreal halfAngle) const
+{
+    QVector<QPair<qreal, PhotoSphereTileId>> visible;
+    const QVector3D dir = viewDir.normalized();
+    const int n = tilesPerSide(level);
+    for (int f = CubeFace::PX; f != CubeFace::InvalidFace; f++ ) {
+        const CubeFace face = CubeFace(f);
+        QVector3D center;
+        const qreal faceRadius = angularExtent(face, QRectF(0, 0, 1, 1), &center);
+        if (angleBetween(center, dir) - faceRadius > halfAngle)
+            continue;
+
+        for (int y = 0; y < n; ++y) {
+            for (int x = 0; x < n; ++x) {
+                const PhotoSphereTileId tile{face, level, x, y};
+                const qreal radius = angularExtent(face, tileRect(tile), &center);
+                const qreal distance = angleBetween(center, dir);
+                if (distance - radius <= halfAngle)
+                    visible.append(qMakePair(distance, tile));
+            }
+        }
+    }
+
+    std::sort(visible.begin(), visible.end(),
+              [](const QPair<qreal, PhotoSphereTileId> &a, const QPair<qreal, PhotoSphereTileId> &b) {
+        return a.first < b.first;
+    });
+    QVector<PhotoSphereTileId> res;
+    res.reserve(visible.size());
+    for (const auto &v : qAsConst(visible))
+        res.append(v.second);
+    return res;
+}
+
+QVector<CubeFace> PhotoSphereTileLayout::visibleFaces(const QVector3D &viewDir, qreal halfAngle)
+{
+    QVector<QPair<qreal, CubeFace>> visible;
+    const QVector3D dir = viewDir.normalized();
+    for (int f = CubeFace::PX; f != CubeFace::InvalidFace; f++ ) {
+        QVector3D center;
+        const qreal radius = angularExtent(CubeFace(f), QRectF(0, 0, 1, 1), &center);
+        const qreal distance = angleBetween(center, dir);
+        if (distance - radius <= halfAngle)
+            visible.append(qMakePair(distance, CubeFace(f)));
+    }
+
+    std::sort(visible.begin(), visible.end(),
+              [](const QPair<qreal, CubeFace> &a, const QPair<qreal, CubeFace> &b) {
+        return a.first < b.first;
+    });
+    QVector<CubeFace> res;
+    res.reserve(visible.size());
+    for (const auto &v : qAsConst(visible))
+        res.append(v.second);
+    return res;
+}
+
+QVector3D PhotoSphereTileLayout::facePoint(CubeFace face, qreal u, qreal v)
+{
+    // Matches the orientation of the faces in PhotoSphereRendererCube
+    const float a = float(1.0 - 2.0 * u);
+    const float b = float(1.0 - 2.0 * v);
+    switch (face) {
+    case CubeFace::PX:
+        return QVector3D( 1,  b, -a);
+    case CubeFace::MX:
+        return QVector3D(-1,  b,  a);
+    case CubeFace::PY:
+        return QVector3D( a,  1, -b);
+    case CubeFace::MY:
+        return QVector3D( a, -1,  b);
+    case CubeFace::PZ:
+        return QVector3D( a,  b,  1);
+    case CubeFace::MZ:
+    default:
+        return QVector3D(-a,  b, -1);
+    }
+}
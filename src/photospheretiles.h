@@ -0,0 +1,104 @@
+/****************************************************************************
+**
+** Copyright (C) 2023- Paolo Angelelli <paolo.angelelli@gmail.com>
+**
+** Commercial License Usage
+** Licensees holding a valid commercial QmlPanorama license may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement with the copyright holder. For licensing terms
+** and conditions and further information contact the copyright holder.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3. The licenses are as published by
+** the Free Software Foundation at https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef PHOTOSPHERETILES_H
+#define PHOTOSPHERETILES_H
+
+#include "photosphere.h"
+#include <QVariantMap>
+#include <QVector>
+#include <QVector3D>
+#include <QRectF>
+#include <QHash>
+#include <QMap>
+#include <QUrl>
+
+/// Identifies a tile of a PhotoSphereTileLayout
+struct PhotoSphereTileId
+{
+    CubeFace face = CubeFace::InvalidFace;
+    int level = 0;
+    int x = 0;
+    int y = 0;
+
+    bool operator==(const PhotoSphereTileId &o) const
+    {
+        return face == o.face && level == o.level && x == o.x && y == o.y;
+    }
+    bool operator!=(const PhotoSphereTileId &o) const { return !(*this == o); }
+};
+
+inline uint qHash(const PhotoSphereTileId &tile, uint seed = 0)
+{
+    return qHash((quint64(tile.face) << 56) | (quint64(tile.level) << 48)
+                 | (quint64(tile.y) << 24) | quint64(tile.x), seed);
+}
+
+/// PhotoSphereTileLayout describes a multi-resolution tiled cube map source:
+/// each face is stored at several levels of resolution, each level split in square tiles,
+/// as in the layouts used by Marzipano or krpano.
+/// It also encapsulates the logic to select the tiles needed for a view.
+class PhotoSphereTileLayout
+{
+public:
+    /// Parses a source map, see PhotoSphere::source. Returns an invalid layout on failure.
+    static PhotoSphereTileLayout fromVariantMap(const QVariantMap &map);
+    /// Whether a source map describes a tiled source, valid or not
+    static bool isTiledSource(const QVariantMap &map);
+
+    bool isValid() const { return m_tileSize > 0 && !m_levels.isEmpty(); }
+    int tileSize() const { return m_tileSize; }
+    int levelCount() const { return m_levels.size(); }
+    int levelSize(int level) const { return m_levels.at(level); }
+    int tilesPerSide(int level) const { return (m_levels.at(level) + m_tileSize - 1) / m_tileSize; }
+
+    QUrl tileUrl(const PhotoSphereTileId &tile) const;
+    /// The area covered by tile, in normalized face coordinates, (0,0) being the top left
+    /// corner of the face as seen from inside the cube.
+    QRectF tileRect(const PhotoSphereTileId &tile) const;
+    /// All the tiles of level, for all faces
+    QVector<PhotoSphereTileId> tiles(int level) const;
+
+    /// The smallest level providing at least one texel per pixel at the center of the view,
+    /// or the largest one if none does.
+    int levelFor(qreal viewportHeight, qreal fov) const;
+    /// The tiles of level that may intersect the view cone of half angle halfAngle,
+    /// in radians, around viewDir. Sorted by distance from viewDir.
+    QVector<PhotoSphereTileId> visibleTiles(int level, const QVector3D &viewDir, qreal halfAngle) const;
+    /// The faces of a cube map that may intersect the view cone of half angle halfAngle,
+    /// in radians, around viewDir. Sorted by distance from viewDir.
+    static QVector<CubeFace> visibleFaces(const QVector3D &viewDir, qreal halfAngle);
+
+    /// The point on the cube of side 2 centered in the origin, at normalized coordinates (u, v) of face
+    static QVector3D facePoint(CubeFace face, qreal u, qreal v);
+
+    bool operator==(const PhotoSphereTileLayout &o) const
+    {
+        return m_urlTemplate == o.m_urlTemplate && m_tileSize == o.m_tileSize
+                && m_levels == o.m_levels && m_faceNames == o.m_faceNames;
+    }
+    bool operator!=(const PhotoSphereTileLayout &o) const { return !(*this == o); }
+
+private:
+    QString m_urlTemplate;
+    int m_tileSize = 0;
+    QVector<int> m_levels;
+    QMap<CubeFace, QString> m_faceNames;
+};
+
+#endif // PHOTOSPHERETILES_H
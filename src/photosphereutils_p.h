@@ -0,0 +1,62 @@
+/****************************************************************************
+**
+** Copyright (C) 2023- Paolo Angelelli <paolo.angelelli@gmail.com>
+**
+** Commercial License Usage
+** Licensees holding a valid commercial QmlPanorama license may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement with the copyright holder. For licensing terms
+** and conditions and further information contact the copyright holder.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3. The licenses are as published by
+** the Free Software Foundation at https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef PHOTOSPHEREUTILS_P_H
+#define PHOTOSPHEREUTILS_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QmlPanorama API. It holds the helpers shared
+// by its implementation files, and may change without notice.
+//
+
+#include "photosphere.h"
+#include <QRunnable>
+#include <QMap>
+#include <QString>
+#include <functional>
+#include <utility>
+
+/// The cube faces, by the names used for them in the source maps of PhotoSphere::source
+inline const QMap<QString, CubeFace> &nameToCubeFace()
+{
+    static const QMap<QString, CubeFace> names {{
+            {"PositiveZ" , CubeFace::PZ},
+            {"PositiveX" , CubeFace::PX},
+            {"PositiveY" , CubeFace::PY},
+            {"NegativeZ" , CubeFace::MZ},
+            {"NegativeY" , CubeFace::MY},
+            {"NegativeX" , CubeFace::MX}
+    }};
+    return names;
+}
+
+/// Utility QRunnable wrapping a callable, to run work on a QThreadPool
+class PhotoSphereJob : public QRunnable
+{
+public:
+    explicit PhotoSphereJob(std::function<void()> job) : m_job(std::move(job)) { }
+    void run() override { m_job(); }
+
+private:
+    std::function<void()> m_job;
+};
+
+#endif // PHOTOSPHEREUTILS_P_H
@@ -23,6 +23,8 @@
 
 void registerQmlPanorama() {
     qmlRegisterType<QmlPhotoSphere>("QmlPanorama", 1, 0, "PhotoSphere");
+    qmlRegisterUncreatableType<PhotoSphereStats>("QmlPanorama", 1, 0, "PhotoSphereStats",
+                                                 QStringLiteral("PhotoSphereStats is available as PhotoSphere.stats"));
 }
 
 #endif // QMLPANORAMA_H
@@ -0,0 +1,11 @@
+TEMPLATE = app
+TARGET = tst_benchmarks
+
+QT += qml quick testlib
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+include($$PWD/../../qmlpanorama.pri)
+SOURCES += tst_benchmarks.cpp
+
+DEFINES += SAMPLE_DATA_DIR=\\\"$$PWD/../../sample_data\\\"
@@ -0,0 +1,342 @@
+/****************************************************************************
+**
+** Copyright (C) 2023- Paolo Angelelli <paolo.angelelli@gmail.com>
+**
+** Commercial License Usage
+** Licensees holding a valid commercial QmlPanorama license may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement with the copyright holder. For licensing terms
+** and conditions and further information contact the copyright holder.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3. The licenses are as published by
+** the Free Software Foundation at https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "photosphere.h"
+#include "photospherecache.h"
+#include "photosphererender_p.h"
+#include <QtTest>
+#include <QOffscreenSurface>
+#include <QOpenGLFramebufferObject>
+#include <QQuickRenderControl>
+#include <QQuickWindow>
+#include <QTemporaryDir>
+#include <limits>
+
+// Benchmarks of the loading and rendering stages, one per stage, on the sample data and on
+// synthetic 8K and 16K panoramas. Run on the offscreen platform plugin where there is no
+// display, e.g. in CI:
+//   QT_QPA_PLATFORM=offscreen ./tst_benchmarks
+// The upload and frame benchmarks are skipped without an OpenGL context, the upload ones also
+// when the texture is larger than GL_MAX_TEXTURE_SIZE.
+
+namespace {
+const QString samplePanorama = QStringLiteral(SAMPLE_DATA_DIR "/kloster_weltenburg.jpg");
+const QSize frameSize(1920, 1080);
+const int maxUploadFrames = 1000;
+
+QVariantMap sampleCubeMap()
+{
+    const QString base = QUrl::fromLocalFile(QStringLiteral(SAMPLE_DATA_DIR "/kloster_weltenburg_cube_face_")).toString();
+    QVariantMap cubeMap;
+    cubeMap.insert(QStringLiteral("PositiveX"), base + QStringLiteral("1.jpg"));
+    cubeMap.insert(QStringLiteral("PositiveY"), base + QStringLiteral("4.jpg"));
+    cubeMap.insert(QStringLiteral("PositiveZ"), base + QStringLiteral("2.jpg"));
+    cubeMap.insert(QStringLiteral("NegativeX"), base + QStringLiteral("3.jpg"));
+    cubeMap.insert(QStringLiteral("NegativeY"), base + QStringLiteral("5.jpg"));
+    cubeMap.insert(QStringLiteral("NegativeZ"), base + QStringLiteral("0.jpg"));
+    return cubeMap;
+}
+
+/// An image of size with gradients and a fine pattern, so that it encodes and compresses
+/// more like a photograph than a flat color would
+QImage syntheticImage(const QSize &size, QImage::Format format)
+{
+    QImage image(size, format);
+    if (image.isNull())
+        return image;
+    const int bytesPerPixel = image.depth() / 8;
+    for (int y = 0; y < size.height(); ++y) {
+        uchar *pixel = image.scanLine(y);
+        for (int x = 0; x < size.width(); ++x, pixel += bytesPerPixel) {
+            pixel[0] = uchar(x * 255 / size.width());
+            pixel[1] = uchar(y * 255 / size.height());
+            pixel[2] = uchar((x ^ y) & 0xff);
+            if (bytesPerPixel == 4)
+                pixel[3] = 0xff;
+        }
+    }
+    return image;
+}
+
+/// Waits for image to load, returning true if it did
+bool waitReady(PhotoSphereImage *image)
+{
+    if (image->status() == PhotoSphereImage::Loading) {
+        QSignalSpy finished(image, &PhotoSphereImage::finished);
+        if (!finished.wait(120000))
+            return false;
+    }
+    return image->status() == PhotoSphereImage::Ready;
+}
+}
+
+class tst_Benchmarks : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void generateSphere();
+    void decode_data();
+    void decode();
+    void loadCubeMap_data();
+    void loadCubeMap();
+    void upload_data();
+    void upload();
+    void renderFrame_data();
+    void renderFrame();
+
+private:
+    QString writeJpeg(const QString &name, const QSize &size);
+    void initRenderControl();
+    void render();
+
+    QTemporaryDir m_dir;
+    QString m_synthetic8K;
+    QString m_synthetic16K;
+    QVariantMap m_syntheticCubeMap;
+    QOpenGLContext m_context;
+    QOffscreenSurface m_surface;
+    QQuickRenderControl *m_renderControl = nullptr;
+    QScopedPointer<QQuickWindow> m_window;
+    QmlPhotoSphere *m_item = nullptr;
+    QScopedPointer<QOpenGLFramebufferObject> m_fbo;
+};
+
+/// Writes a synthetic image of size to the temporary directory, returning its path
+QString tst_Benchmarks::writeJpeg(const QString &name, const QSize &size)
+{
+    const QString path = m_dir.filePath(name);
+    if (!syntheticImage(size, QImage::Format_RGB888).save(path, "JPG", 90))
+        return QString();
+    return path;
+}
+
+void tst_Benchmarks::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    // Not to read converted cube maps from, or write them to, the user cache
+    PhotoSphereImageCache::setDiskCacheDirectory(QString());
+
+    m_synthetic8K = writeJpeg(QStringLiteral("synthetic_8k.jpg"), QSize(8192, 4096));
+    QVERIFY(!m_synthetic8K.isEmpty());
+    m_synthetic16K = writeJpeg(QStringLiteral("synthetic_16k.jpg"), QSize(16384, 8192));
+    QVERIFY(!m_synthetic16K.isEmpty());
+
+    // The faces of a 16K panorama. Each face has its own url, as images are shared by url.
+    const QString face = writeJpeg(QStringLiteral("synthetic_face.jpg"), QSize(4096, 4096));
+    QVERIFY(!face.isEmpty());
+    const QStringList names { "PositiveX", "PositiveY", "PositiveZ", "NegativeX", "NegativeY", "NegativeZ" };
+    for (const QString &name : names) {
+        const QString path = m_dir.filePath(QStringLiteral("synthetic_face_%1.jpg").arg(name));
+        QVERIFY(QFile::copy(face, path));
+        m_syntheticCubeMap.insert(name, QUrl::fromLocalFile(path).toString());
+    }
+
+    m_surface.create();
+    if (m_context.create())
+        m_context.makeCurrent(&m_surface);
+}
+
+void tst_Benchmarks::cleanupTestCase()
+{
+    if (!m_renderControl)
+        return;
+    // The scene graph releases its GL resources, those of the renderers included, on invalidate
+    m_context.makeCurrent(&m_surface);
+    m_renderControl->invalidate();
+    m_window.reset();
+    delete m_renderControl;
+    m_fbo.reset();
+}
+
+/// An item rendered offscreen, straight into a framebuffer object, as in PhotoSphereBatchRenderer
+void tst_Benchmarks::initRenderControl()
+{
+    m_renderControl = new QQuickRenderControl;
+    m_window.reset(new QQuickWindow(m_renderControl));
+    m_item = new QmlPhotoSphere(m_window->contentItem());
+    m_item->setDirectRendering(true);
+    m_renderControl->initialize(&m_context);
+    m_fbo.reset(new QOpenGLFramebufferObject(frameSize, QOpenGLFramebufferObject::CombinedDepthStencil));
+    m_window->setRenderTarget(m_fbo.data());
+    m_window->setGeometry(QRect(QPoint(), frameSize));
+    m_item->setSize(frameSize);
+}
+
+void tst_Benchmarks::render()
+{
+    m_renderControl->polishItems();
+    m_renderControl->sync();
+    m_renderControl->render();
+}
+
+void tst_Benchmarks::generateSphere()
+{
+    QBENCHMARK {
+        Sphere3D sphere;
+        sphere.generateSphere();
+    }
+}
+
+void tst_Benchmarks::decode_data()
+{
+    QTest::addColumn<QString>("path");
+    QTest::addColumn<int>("maxTexSize");
+
+    QTest::newRow("sample") << samplePanorama << std::numeric_limits<int>::max();
+    QTest::newRow("sample, scaled to 2K") << samplePanorama << 2048;
+    QTest::newRow("8K") << m_synthetic8K << std::numeric_limits<int>::max();
+    QTest::newRow("8K, scaled to 4K") << m_synthetic8K << 4096;
+    QTest::newRow("16K, scaled to 8K") << m_synthetic16K << 8192;
+    QTest::newRow("16K, scaled to 4K") << m_synthetic16K << 4096;
+}
+
+/// Reading, decoding and scaling, through the image cache and the thread pool, as in PhotoSphere
+void tst_Benchmarks::decode()
+{
+    QFETCH(QString, path);
+    QFETCH(int, maxTexSize);
+    const QUrl url = QUrl::fromLocalFile(path);
+
+    QBENCHMARK {
+        // Dropped at the end of each iteration, for the next one to decode again
+        const QSharedPointer<PhotoSphereImage> image = PhotoSphereImageCache::instance()->image(url, maxTexSize);
+        QVERIFY(waitReady(image.data()));
+    }
+}
+
+void tst_Benchmarks::loadCubeMap_data()
+{
+    QTest::addColumn<QVariantMap>("cubeMap");
+
+    QTest::newRow("sample") << sampleCubeMap();
+    QTest::newRow("16K, 4K faces") << m_syntheticCubeMap;
+}
+
+/// Loading a cube map source, until all the faces are decoded
+void tst_Benchmarks::loadCubeMap()
+{
+    QFETCH(QVariantMap, cubeMap);
+
+    QBENCHMARK {
+        // A new item each time, as an item ignores the source it already has
+        QmlPhotoSphere item;
+        QSignalSpy statusChanged(&item, &QmlPhotoSphere::statusChanged);
+        item.setSource(cubeMap);
+        while (item.status() == QmlPhotoSphere::Loading)
+            QVERIFY(statusChanged.wait(120000));
+        QCOMPARE(int(item.status()), int(QmlPhotoSphere::Ready));
+    }
+}
+
+void tst_Benchmarks::upload_data()
+{
+    QTest::addColumn<QString>("path"); // a synthetic image of size if empty
+    QTest::addColumn<QSize>("size");
+    QTest::addColumn<bool>("mipMaps");
+
+    QTest::newRow("sample") << samplePanorama << QSize() << true;
+    QTest::newRow("sample, no mip maps") << samplePanorama << QSize() << false;
+    QTest::newRow("8K") << QString() << QSize(8192, 4096) << true;
+    QTest::newRow("8K, no mip maps") << QString() << QSize(8192, 4096) << false;
+    QTest::newRow("16K") << QString() << QSize(16384, 8192) << true;
+    QTest::newRow("16K, no mip maps") << QString() << QSize(16384, 8192) << false;
+}
+
+/// Uploading a decoded image to a texture, in bands as the renderers do over several frames,
+/// waiting for the GPU to complete it
+void tst_Benchmarks::upload()
+{
+    QFETCH(QString, path);
+    QFETCH(QSize, size);
+    QFETCH(bool, mipMaps);
+
+    if (!m_context.isValid())
+        QSKIP("No OpenGL context");
+    QVERIFY(m_context.makeCurrent(&m_surface));
+    QOpenGLFunctions *f = m_context.functions();
+
+    const QImage image = path.isEmpty() ? syntheticImage(size, QImage::Format_RGBA8888)
+                                        : QImage(path).convertToFormat(QImage::Format_RGBA8888);
+    QVERIFY(!image.isNull());
+    GLint maxTexSize = 0;
+    f->glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTexSize);
+    if (image.width() > maxTexSize || image.height() > maxTexSize)
+        QSKIP("Larger than GL_MAX_TEXTURE_SIZE");
+
+    QBENCHMARK {
+        PhotoSphereTextureUpload upload(PhotoSphereTextureCache::Key(), image);
+        upload.mipMaps = mipMaps;
+        while (!upload.step(f)) { }
+        f->glFinish();
+    }
+}
+
+void tst_Benchmarks::renderFrame_data()
+{
+    QTest::addColumn<QVariant>("source");
+    QTest::addColumn<bool>("rayCasting");
+
+    const QVariant equirect = QUrl::fromLocalFile(samplePanorama).toString();
+    QTest::newRow("equirect") << equirect << false;
+    QTest::newRow("equirect, ray casting") << equirect << true;
+    QTest::newRow("cube map") << QVariant(sampleCubeMap()) << false;
+}
+
+/// Steady state frames, once the textures of the source are resident, waiting for the GPU to
+/// complete each
+void tst_Benchmarks::renderFrame()
+{
+    QFETCH(QVariant, source);
+    QFETCH(bool, rayCasting);
+
+    if (!m_context.isValid())
+        QSKIP("No OpenGL context");
+    QVERIFY(m_context.makeCurrent(&m_surface));
+    if (!m_renderControl)
+        initRenderControl();
+
+    m_item->setRayCasting(rayCasting);
+    QSignalSpy statusChanged(m_item, &QmlPhotoSphere::statusChanged);
+    m_item->setSource(source);
+    while (m_item->status() == QmlPhotoSphere::Loading)
+        QVERIFY(statusChanged.wait(120000));
+    QCOMPARE(int(m_item->status()), int(QmlPhotoSphere::Ready));
+
+    // Textures are uploaded in bands over several frames
+    for (int frames = 0; m_item->m_residentSourceId->loadAcquire() != m_item->m_sourceId; ++frames) {
+        QVERIFY2(frames < maxUploadFrames, "Timed out uploading the textures");
+        QVERIFY(m_context.makeCurrent(&m_surface));
+        render();
+        QCoreApplication::processEvents();
+    }
+
+    QVERIFY(m_context.makeCurrent(&m_surface));
+    QOpenGLFunctions *f = m_context.functions();
+    QBENCHMARK {
+        render();
+        f->glFinish();
+    }
+}
+
+QTEST_MAIN(tst_Benchmarks)
+
+#include "tst_benchmarks.moc"